@@ -33,7 +33,8 @@
 
 
 // Usage Notes:
-// ARTK makes use of the Arduino TimerOne library, which is distributed with it.
+// ARTK drives its tick from a Timer1 compare interrupt, so the TimerOne
+// library (or anything else that uses Timer1) can't be used alongside it.
 // You must NOT implement a setup() function
 // Implement a Setup() function instead - ARTK will call it for you
 // You must NOT implement a loop() function
@@ -45,28 +46,66 @@
 
 #include <kernel.h>
 
-// This library won't work on with task stacks less than about 210,
+// This library won't work with task stacks less than MIN_STACK (128),
 // so the library won't let you set a stack size less than that
-// This is the default size - only a bit larger than the min
+// This is the default size.  Stacks are allocated from an arena of 
+// STACK_ARENA bytes (see kernel.h), so small tasks can ask for less.
 #if defined(__AVR_ATmega328P__)
 	#define DEFAULT_STACK 128
 #elif defined (__AVR_ATmega1280__)
 	#define DEFAULT_STACK 256
 #elif defined (__AVR_ATmega2560__)
 	#define DEFAULT_STACK 384
+#elif !defined(__AVR__)
+	// the host port (extras/host), where tasks run on native stacks
+	#define DEFAULT_STACK 16384
 #else
 	#define DEFAULT_STACK 128
 #endif
 
 class Task ;
 typedef Task* TASK ;
+class Semaphore ;
+typedef Semaphore* SEMAPHORE ;
+class Mutex ;
+typedef Mutex* MUTEX ;
+class MessageQueue ;
+typedef MessageQueue* QUEUE ;
+class EventGroup ;
+typedef EventGroup* EVENTGROUP ;
+class SoftTimer ;
+typedef SoftTimer* TIMER ;
 
 // IMPORTANT: Call this from Setup() only, and only if you don't like a default
 // For each option, -1 says to use the default
 // iLargeModel:  1 if you have more than 64k memory (e.g., Mega)
 //               0 otherwise (e.g., UNO)
 //               Defaults to 0
-void ARTK_SetOptions(int iLargeModel) ;
+// iIdleMode:    what the processor does when no task is ready
+//               ARTK_IDLE_SLEEP: idle sleep until the next sleeper is due
+//               ARTK_IDLE_DEEP: as above, but power down when no task is
+//               sleeping.  Only an external interrupt can wake the processor
+//               from power-down, and millis() does not advance meanwhile.
+//               Defaults to ARTK_IDLE_SLEEP
+// iTickInterval: period of the kernel tick in microseconds, which is the
+//               unit of ARTK_Sleep.  The tick is a Timer1 compare interrupt,
+//               so Timer1 is not available to the application.
+//               Defaults to DEFAULT_TICK (1 ms)
+#define ARTK_IDLE_SLEEP   0
+#define ARTK_IDLE_DEEP    1
+#define DEFAULT_TICK      1000
+void ARTK_SetOptions(int iLargeModel, int iIdleMode = -1, 
+                     int iTickInterval = -1) ;
+
+// Number of ticks since multitasking started
+unsigned long ARTK_GetTicks() ;
+
+// Number of times the processor went to sleep for lack of a ready task,
+// and the CPU cycles it spent asleep (not counted in power-down)
+void ARTK_GetIdleStats(unsigned long *entries, unsigned long *cycles) ;
+
+// Timeout for the waits below that never time out
+#define ARTK_FOREVER 0
 
 // Task functions
 // Valid user task priority is 1 to 16 (1 being lowest)
@@ -76,22 +115,299 @@ void ARTK_SetOptions(int iLargeModel) ;
 // (or allowing an ISR to signal a semaphore), or waiting on a semaphore, 
 // or sleeping.  Of course, once a higher priority task starts up, it can 
 // take the processor anytime it is ready to do so.
-TASK ARTK_CreateTask(void (*root_fn_ptr)(), unsigned stacksize = DEFAULT_STACK) ;
+// Priorities outside 1 to 16 are clamped into that range.  The priority
+// comes last so that sketches written for the old two argument form, 
+// ARTK_CreateTask(fn, stacksize), still mean the same thing; their tasks
+// all get DEFAULT_PRIORITY, as equals.
+// Returns NULL if there is no free task or not enough stack arena left.
+#define DEFAULT_PRIORITY 8
+TASK ARTK_CreateTask(void (*root_fn_ptr)(), unsigned stacksize = DEFAULT_STACK,
+                     unsigned priority = DEFAULT_PRIORITY) ;
+
+// A task ends when its root function returns, or when it is deleted.  
+// Either way its slot and stack go back for new tasks, mutexes it holds 
+// pass to their next waiter, and tasks joined to it are woken.
+// ARTK_DeleteTask(NULL) deletes the caller.  A TASK handle is only good
+// until its task ends - the slot may then be reused by a new task.
+// The timer service task and the defer worker can't be deleted.
+void ARTK_DeleteTask(TASK task) ;
+
+// Wait for a task to end.  Waits at most timeout ticks, or forever if 
+// timeout is ARTK_FOREVER.  Returns 0 if it timed out (or the task is the
+// caller).  Returns at once if the task has already ended.
+char ARTK_Join(TASK task, unsigned timeout = ARTK_FOREVER) ;
+
+// Declares a task at compile time, at file scope:
+//    ARTK_TASK(blinker, Blink, 128, 3) ;
+// The task descriptor and its stack are static variables, so they are
+// counted in the data size at build time and take nothing from the task 
+// slots or the stack arena (which can then be shrunk with STACK_ARENA).
+// The task starts with the others once Setup() returns, and name is its
+// TASK handle within the file.  It ends like any other task, but its 
+// memory isn't reused.
+#define ARTK_TASK(name, fn, stacksize, prio) \
+	static unsigned char name##_stack[(stacksize) < MIN_STACK ? \
+	                                  MIN_STACK : (stacksize)] ; \
+	static Task name##_task(fn, prio, name##_stack, sizeof(name##_stack)) ; \
+	TASK const name = &name##_task
+
+// Bytes left in the stack arena for further tasks
+unsigned ARTK_StackArenaFree() ;
+
+// Stacks are painted when a task is created.  This returns the most stack
+// the task has used so far, found by scanning for the untouched paint, so 
+// stack sizes can be tuned to what the tasks really need.
+unsigned ARTK_StackHighWater(TASK task) ;
+
+// Stack space left right now for the calling task
+unsigned ARTK_StackLeft() ;
+
+// Every context switch checks that the outgoing task's stack pointer is 
+// still within its stack and that the bottom byte is still painted.  If
+// not, the hook is called with that task (with interrupts disabled, on the
+// overflowing stack) - typically to report it and halt.  There is no hook
+// by default.
+void ARTK_SetStackOverflowHook(void (*hook)(TASK)) ;
+
+// Change the priority of a task at runtime.  If this leaves a ready task
+// with a higher priority than the caller, the caller is preempted.
+// A task holding a mutex keeps any higher priority it has inherited.
+// ARTK_GetPriority returns the priority the task runs at, inheritance 
+// included.
+void ARTK_SetPriority(TASK task, unsigned priority) ;
+unsigned ARTK_GetPriority(TASK task) ;
+
+// Earliest deadline first scheduling
+// Build with ARTK_EDF defined to give tasks deadlines.  A task with a 
+// relative deadline of so many ticks gets an absolute deadline each time 
+// it is released - created, or readied after sleeping or waiting - and 
+// among the ready tasks of one priority the earliest deadline runs, ahead
+// of any without a deadline.  So put the tasks to be scheduled by 
+// deadline at one priority; tasks above it still preempt them, and tasks
+// below run when none of them is ready.  For a periodic task the deadline
+// is usually its period.  Priority inheritance goes by priority only.
+// ARTK_SetDeadline(task, 0) takes the deadline away, and a NULL task is 
+// the caller, whose current job gets the new deadline from now.
+// ARTK_GetDeadlineMisses returns the number of jobs that blocked or slept
+// after the tick their deadline fell in, and clears the count.
+#ifdef ARTK_EDF
+void ARTK_SetDeadline(TASK task, unsigned ticks) ;
+unsigned ARTK_GetDeadlineMisses(TASK task) ;
+#endif
 
 // Sleep for so many ticks.  See ARTK_SetOptions above for the tick interval.
 // inlined 
 void ARTK_Sleep(unsigned ticks) ;
 
-// ARTK is preemptive but does not timeshare automatically between tasks of 
-// equal priority.  Don't create tasks of equal priority unless you don't 
-// care about their relative scheduling.  If you create tasks of equal 
-// priority, make sure they yield somewhere in order to allow other
-// tasks of the same priority to run.  They can yield by sleeping, by waiting
-// on a semaphore, by signaling a semaphore (directly or via an ISR), by
-// exiting, or explicitly yielding:
+// Sleep until period ticks after *lastWake, and advance *lastWake by period.
+// For a periodic task, initialize lastWake with ARTK_GetTicks() and call 
+// this once per period - the wake times don't drift with the time the task
+// takes between calls, and the tick count wrapping is handled.  Returns 0
+// without sleeping if that time has already passed (a missed period).
+// inlined 
+char ARTK_SleepUntil(unsigned long *lastWake, unsigned period) ;
+
+// ARTK is preemptive but by default does not timeshare between tasks of 
+// equal priority.  Tasks of equal priority must yield somewhere in order
+// to allow the others to run, unless their priority has a time slice (see
+// below).  They can yield by sleeping, by waiting on a semaphore, by 
+// signaling a semaphore (directly or via an ISR), by exiting, or 
+// explicitly yielding:
 // inlined 
 void ARTK_Yield() ;
 
+// Round robin time slicing for tasks of one priority.  A task that has run
+// for ticks ticks (1 to 255) while another task of its priority is ready 
+// is moved behind it, as if it had yielded.  A task that is preempted 
+// keeps the rest of its slice; one that blocks, sleeps or yields starts a
+// fresh slice when it is readied.  0 turns slicing off for the priority, 
+// which is the default.  Each rotation is a context switch from the tick,
+// so short slices cost CPU time.  With ARTK_EDF, tasks with deadlines 
+// stay in deadline order and only rotate among equal deadlines.
+void ARTK_SetTimeSlice(unsigned priority, unsigned ticks) ;
+
+// Counting semaphores
+// Up to MAX_SEMAPHORES (see kernel.h) can be created.  Returns NULL if none
+// are left.
+SEMAPHORE ARTK_CreateSemaphore(int initialCount = 0) ;
+
+// Take the semaphore, blocking while the count is 0.  Waiters are woken 
+// highest priority first.
+void ARTK_Wait(SEMAPHORE sema) ;
+
+// Give the semaphore.  If this wakes a task of higher priority than the
+// caller, it runs immediately.
+void ARTK_Signal(SEMAPHORE sema) ;
+
+// Give the semaphore from an interrupt handler.  Returns nonzero if it woke
+// a task that outranks the interrupted one, in which case the handler 
+// should end with ARTK_YieldFromISR() to switch to it right away.  
+// Otherwise the switch waits for the next tick.
+char ARTK_SignalFromISR(SEMAPHORE sema) ;
+
+// Call as the last thing in an interrupt handler to switch to a task 
+// readied by the handler if it outranks the interrupted one.  The rest of
+// the handler (its epilogue) completes when the interrupted task resumes.
+// It only compares priorities when there is nothing to switch to, so it
+// is cheap to call unconditionally.
+void ARTK_YieldFromISR() ;
+
+// Direct-to-task notifications
+// Every task has a word of 16 notification bits, so signalling one known 
+// task (typically from an interrupt handler) needs no semaphore.
+// ARTK_Notify sets bits in the task's word, and switches to the task if 
+// that satisfies its wait and it outranks the caller.  From an interrupt
+// handler use ARTK_NotifyFromISR, which returns nonzero when the handler 
+// should end with ARTK_YieldFromISR().
+void ARTK_Notify(TASK task, unsigned bits) ;
+char ARTK_NotifyFromISR(TASK task, unsigned bits) ;
+
+// Wait until any of the bits in mask are set in the caller's notification
+// word, then clear and return them.  Bits already set return at once.
+// Waits at most timeout ticks, or forever if timeout is ARTK_FOREVER.
+// Returns 0 if it timed out.
+unsigned ARTK_WaitNotify(unsigned mask, unsigned timeout = ARTK_FOREVER) ;
+
+// Message queues of fixed size items, for passing data from one producer
+// (typically an interrupt handler) to one consumer task.  Neither side
+// disables interrupts to move data, and the consumer sleeps while the 
+// queue is empty.  The buffer comes from the stack arena.
+// Up to MAX_QUEUES (see kernel.h, 0 by default, which leaves them out) 
+// can be created.  Returns NULL if none are left or there isn't room in
+// the arena.
+#if MAX_QUEUES > 0
+QUEUE ARTK_CreateQueue(unsigned char itemSize, unsigned char length) ;
+
+// Copy an item in.  Returns 0 without blocking if the queue is full.
+// ARTK_QueueSend switches to the consumer if it was waiting and outranks 
+// the caller; from an interrupt handler use ARTK_QueueSendFromISR, and 
+// then ARTK_YieldFromISR.
+char ARTK_QueueSend(QUEUE queue, const void *item) ;
+char ARTK_QueueSendFromISR(QUEUE queue, const void *item) ;
+
+// Copy the oldest item out, waiting while the queue is empty.  Waits at 
+// most timeout ticks, or forever if timeout is ARTK_FOREVER.  Returns 0 if
+// it timed out.
+char ARTK_QueueReceive(QUEUE queue, void *item, 
+                       unsigned timeout = ARTK_FOREVER) ;
+
+// Number of items waiting
+unsigned char ARTK_QueueCount(QUEUE queue) ;
+#endif
+
+// Event groups - 16 event bits that tasks can wait on in combination
+// Up to MAX_EVENTGROUPS (see kernel.h, 0 by default, which leaves them 
+// out) can be created.  Returns NULL if none are left.
+#if MAX_EVENTGROUPS > 0
+EVENTGROUP ARTK_CreateEventGroup() ;
+
+// Wait until any (or all) of the bits in mask are set.  With clearOnExit,
+// the bits in mask are cleared when the wait is satisfied.  Waits at most
+// timeout ticks, or forever if timeout is ARTK_FOREVER.  Returns the 
+// group's bits as they were when the wait was satisfied, or 0 on timeout.
+unsigned ARTK_WaitAny(EVENTGROUP group, unsigned mask, char clearOnExit = 0,
+                      unsigned timeout = ARTK_FOREVER) ;
+unsigned ARTK_WaitAll(EVENTGROUP group, unsigned mask, char clearOnExit = 0,
+                      unsigned timeout = ARTK_FOREVER) ;
+
+// Set bits, waking every task whose wait they satisfy.  From an interrupt
+// handler use ARTK_SetEventsFromISR, and then ARTK_YieldFromISR.
+void ARTK_SetEvents(EVENTGROUP group, unsigned mask) ;
+void ARTK_SetEventsFromISR(EVENTGROUP group, unsigned mask) ;
+void ARTK_ClearEvents(EVENTGROUP group, unsigned mask) ;
+unsigned ARTK_GetEvents(EVENTGROUP group) ;
+#endif
+
+// Software timers
+// A timer calls fn(arg) when it expires, from a timer service task of 
+// priority TIMER_PRIORITY (see kernel.h), so a timer costs a few bytes 
+// rather than a task and its stack.  Callbacks may signal, notify, set 
+// events and start or stop timers, but should not block or sleep, since
+// the other timers wait for them.
+// The service task is created with the first timer, from one of the task
+// slots.  Up to MAX_TIMERS (see kernel.h, 0 by default, which leaves 
+// them out) can be created.  Returns NULL if none are left or the service
+// task can't be created.
+#if MAX_TIMERS > 0
+TIMER ARTK_CreateTimer(void (*fn)(void *arg), void *arg = NULL) ;
+
+// Expire after ticks, then every period ticks for an auto-reload timer,
+// or only once if period is 0.  Starting a running timer restarts it.
+// Auto-reload timers don't drift - each period counts from when the last
+// one was due.
+void ARTK_StartTimer(TIMER timer, unsigned ticks, unsigned period = 0) ;
+void ARTK_StopTimer(TIMER timer) ;
+char ARTK_TimerRunning(TIMER timer) ;
+#endif
+
+// Deferred interrupt work
+// An interrupt handler can hand work that needn't be done with interrupts
+// disabled to a worker task, which calls fn(arg) once the handler has 
+// returned, ahead of every task below DEFER_PRIORITY (see kernel.h, the 
+// highest priority by default).  Calls run one at a time in the order 
+// they were deferred.  Like timer callbacks, they may signal, notify and 
+// set events but should not block or sleep.
+// ARTK_CreateDeferWorker creates the worker task, from one of the task 
+// slots - call it from Setup().  Returns 0 if there is no slot left.
+// ARTK_DeferFromISR queues a call; end the handler with ARTK_YieldFromISR
+// so the worker runs straight after it.  Up to DEFER_SIZE calls can wait
+// (see kernel.h, 0 by default, which leaves deferral out).
+// Returns 0, and counts an overflow, if the queue is full or there is no
+// worker.  Handlers that enable interrupts again must not defer.
+#if DEFER_SIZE > 0
+char ARTK_CreateDeferWorker() ;
+char ARTK_DeferFromISR(void (*fn)(void *arg), void *arg = NULL) ;
+unsigned ARTK_DeferOverflows() ;
+#endif
+
+// Mutexes, with priority inheritance
+// While a higher priority task waits for a mutex, the owner runs at the
+// waiter's priority, so medium priority tasks can't hold it off 
+// indefinitely.  The owner drops back to its own priority on unlock.
+// The owner may lock a mutex again; it is released by the matching number
+// of unlocks.  Mutexes can't be used from interrupt handlers.
+// Up to MAX_MUTEXES (see kernel.h) can be created.  Returns NULL if none 
+// are left.
+MUTEX ARTK_CreateMutex() ;
+void ARTK_LockMutex(MUTEX mutex) ;
+// Does nothing unless the caller owns the mutex
+void ARTK_UnlockMutex(MUTEX mutex) ;
+
+// Run time statistics
+// Build with ARTK_STATS defined to have each task's CPU time, the number
+// of times it was switched in and the number of times it was preempted 
+// counted, over a window that starts when multitasking does and again at
+// each ARTK_ResetStats.  Times are in CPU cycles.
+// ARTK_GetTaskStats fills in a TASKSTATS (see kernel.h) with runCycles, 
+// switches and preemptions.  A NULL task gets the idle time, with the 
+// number of times the processor went idle as switches.  Returns 0 if the
+// task has ended.  Dividing runCycles by ARTK_GetStatsWindow gives the
+// share of the CPU - a window should be kept under about 4 minutes at 
+// 16 MHz, or the cycle counts wrap.
+#ifdef ARTK_STATS
+typedef struct TaskStats TASKSTATS ;
+char ARTK_GetTaskStats(TASK task, TASKSTATS *stats) ;
+unsigned long ARTK_GetStatsWindow() ;
+void ARTK_ResetStats() ;
+#endif
+
+// Scheduler trace
+// Build with ARTK_TRACE defined to record task switches, sleeps, wakeups,
+// blocking, idling and ticks into a RAM ring of TRACE_SIZE events (see 
+// kernel.h).  Without it, all of this compiles to nothing.
+// ARTK_TraceDrain is a task root function that sends the events over 
+// Serial every TRACE_DRAIN_TICKS - create it at a low priority and call 
+// Serial.begin() in Setup().  extras/trace/artk_trace.py turns what it 
+// sends into a Chrome trace (chrome://tracing or Perfetto).
+// Interrupt handlers can mark their entry and exit with ARTK_TRACE_ISR, 
+// and any code can drop a numbered marker with ARTK_TRACE_MARK.
+#ifdef ARTK_TRACE
+void ARTK_TraceDrain() ;
+#endif
+#define ARTK_TRACE_ISR(n)      TRACE(TRACE_ISR, n)
+#define ARTK_TRACE_ISR_END(n)  TRACE(TRACE_ISR_END, n)
+#define ARTK_TRACE_MARK(n)     TRACE(TRACE_MARK, n)
+
 // ARTK will terminate when all tasks return (including Main), or you can 
 // terminate early by calling this
 void ARTK_TerminateMultitasking() ;
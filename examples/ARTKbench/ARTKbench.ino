@@ -0,0 +1,225 @@
+// ARTKbench - timing benchmarks for the ARTK kernel
+//
+// Runs each benchmark once and prints a line per result on Serial:
+//    BENCH <name> <param> <cycles>
+// then "BENCH done".  Times are CPU cycles, read from the tick timer, so
+// they are good to 64 cycles; the averages are taken over ROUNDS runs.
+// extras/bench/run_bench.py runs this under simavr and collects the lines
+// as JSON, so the numbers can be compared from one commit to the next.
+//
+//    yield        round     cycles per ARTK_Yield switch between two tasks
+//    sleep_wake   min/avg/max  lateness of ARTK_SleepUntil wakeups
+//    isr_task     min/avg/max  from an interrupt signalling a semaphore
+//                           to the waiting task running
+//    isr_defer    min/avg/max  from an interrupt deferring a call with
+//                           ARTK_DeferFromISR to the call running
+//    isr_time     signal/defer  longest time spent in the interrupt 
+//                           handler above, either way
+//    timer_queue  n         cycles per timer start or stop, with n other 
+//                           timers on the sleep queue ahead of it
+//
+// It needs the optional timers and deferral, which run_bench.py --build
+// turns on with -DMAX_TIMERS=8 -DDEFER_SIZE=8.
+
+#include <ARTK.h>
+
+#if MAX_TIMERS < 8 || DEFER_SIZE == 0
+	#error "build with -DMAX_TIMERS=8 -DDEFER_SIZE=8"
+#endif
+
+#define ROUNDS 200
+
+SEMAPHORE isrSema ;
+volatile unsigned long isrStamp ;
+volatile unsigned long isrTime ;
+volatile char isrDefer ;
+volatile unsigned int isrLeft ;
+volatile unsigned int yields ;
+unsigned long yieldEnd ;
+
+// CPU cycles since multitasking started
+unsigned long cycles()
+{
+   unsigned char sreg = SREG ;
+   unsigned long now ;
+
+   cli() ;
+   now = CycleCount(Scheduler::InstancePtr->tickCount) ;
+   SREG = sreg ;
+   return now ;
+}
+
+void report(const char *name, const char *param, unsigned long value)
+{
+   Serial.print("BENCH ") ;
+   Serial.print(name) ;
+   Serial.print(' ') ;
+   Serial.print(param) ;
+   Serial.print(' ') ;
+   Serial.println(value) ;
+}
+
+void reportStats(const char *name, unsigned long lo, unsigned long sum,
+                 unsigned long hi)
+{
+   report(name, "min", lo) ;
+   report(name, "avg", sum / ROUNDS) ;
+   report(name, "max", hi) ;
+}
+
+// two of these at the same priority hand the processor back and forth
+void Pinger()
+{
+   while (yields < 2 * ROUNDS)
+   {
+      yields++ ;
+      ARTK_Yield() ;
+   }
+   yieldEnd = cycles() ;
+}
+
+void benchYield()
+{
+   TASK a, b ;
+   unsigned long start ;
+
+   yields = 0 ;
+   a = ARTK_CreateTask(Pinger, MIN_STACK, 4) ;
+   b = ARTK_CreateTask(Pinger, MIN_STACK, 4) ;
+   // they only start once this task waits for them
+   start = cycles() ;
+   ARTK_Join(a) ;
+   ARTK_Join(b) ;
+   report("yield", "round", (yieldEnd - start) / (2 * ROUNDS)) ;
+}
+
+void benchSleepWake()
+{
+   unsigned long last = ARTK_GetTicks() ;
+   unsigned long late, lo = 0xFFFFFFFFUL, hi = 0, sum = 0 ;
+   int i ;
+
+   for (i = 0; i < ROUNDS; i++)
+   {
+      ARTK_SleepUntil(&last, 1) ;
+      late = cycles() - TickCycles(last, 0) ;
+      if (late < lo) lo = late ;
+      if (late > hi) hi = late ;
+      sum += late ;
+   }
+   reportStats("sleep_wake", lo, sum, hi) ;
+}
+
+// the deferred half of the interrupt below
+void IsrDeferred(void *arg)
+{
+   ARTK_Signal(isrSema) ;
+}
+
+// Timer2 in CTC mode at clk/64 interrupts about every 1 ms
+ISR(TIMER2_COMPA_vect)
+{
+   unsigned long spent ;
+
+   isrStamp = cycles() ;
+   if (isrDefer)
+      ARTK_DeferFromISR(IsrDeferred) ;
+   else
+      ARTK_SignalFromISR(isrSema) ;
+   spent = cycles() - isrStamp ;
+   if (spent > isrTime)
+      isrTime = spent ;
+   // exactly as many as the waiter counts, so none is left over
+   if (--isrLeft == 0)
+      TIMSK2 = 0 ;
+   ARTK_YieldFromISR() ;
+}
+
+void IsrWaiter()
+{
+   unsigned long lat, lo = 0xFFFFFFFFUL, hi = 0, sum = 0 ;
+   int i ;
+
+   for (i = 0; i < ROUNDS; i++)
+   {
+      ARTK_Wait(isrSema) ;
+      lat = cycles() - isrStamp ;
+      if (lat < lo) lo = lat ;
+      if (lat > hi) hi = lat ;
+      sum += lat ;
+   }
+   reportStats(isrDefer ? "isr_defer" : "isr_task", lo, sum, hi) ;
+   report("isr_time", isrDefer ? "defer" : "signal", isrTime) ;
+}
+
+// With deferral the waiter is signalled by the deferred call, so its 
+// latency includes the trip through the defer worker
+void benchIsrTask(char defer)
+{
+   isrDefer = defer ;
+   isrTime = 0 ;
+   isrLeft = ROUNDS ;
+   TCCR2A = _BV(WGM21) ;
+   OCR2A = 249 ;
+   TCNT2 = 0 ;
+   TIFR2 = _BV(OCF2A) ;
+   TIMSK2 = _BV(OCIE2A) ;
+   TCCR2B = _BV(CS22) ;
+   ARTK_Join(ARTK_CreateTask(IsrWaiter, DEFAULT_STACK, 12)) ;
+   TCCR2B = 0 ;
+}
+
+void NoOp(void *arg)
+{ }
+
+void benchTimerQueue()
+{
+   static const unsigned char counts[] = { 0, 1, 2, 4, 7 } ;
+   TIMER others[7] ;
+   TIMER probe = ARTK_CreateTimer(NoOp) ;
+   unsigned long start ;
+   unsigned char c, n, i ;
+   char param[4] ;
+   int r ;
+
+   for (i = 0; i < 7; i++)
+      others[i] = ARTK_CreateTimer(NoOp) ;
+
+   for (c = 0; c < sizeof(counts); c++)
+   {
+      n = counts[c] ;
+      for (i = 0; i < n; i++)
+         ARTK_StartTimer(others[i], 60000) ;
+      // the probe goes in behind all of them
+      start = cycles() ;
+      for (r = 0; r < ROUNDS; r++)
+      {
+         ARTK_StartTimer(probe, 65000) ;
+         ARTK_StopTimer(probe) ;
+      }
+      itoa(n, param, 10) ;
+      report("timer_queue", param, (cycles() - start) / (2 * ROUNDS)) ;
+      for (i = 0; i < n; i++)
+         ARTK_StopTimer(others[i]) ;
+   }
+}
+
+void Bench()
+{
+   benchYield() ;
+   benchSleepWake() ;
+   benchIsrTask(FALSE) ;
+   benchIsrTask(TRUE) ;
+   benchTimerQueue() ;
+   Serial.println("BENCH done") ;
+   Serial.flush() ;
+   ARTK_TerminateMultitasking() ;
+}
+
+void SetupARTK()
+{
+   Serial.begin(115200) ;
+   isrSema = ARTK_CreateSemaphore(0) ;
+   ARTK_CreateTask(Bench, 192, 8) ;
+   ARTK_CreateDeferWorker() ;
+}
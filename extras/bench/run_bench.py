@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+# run_bench.py - runs the ARTKbench sketch under simavr and reports JSON
+#
+#    run_bench.py --elf ARTKbench.ino.elf [-o results.json]
+#    run_bench.py --build [-o results.json]
+#
+# --build compiles examples/ARTKbench with arduino-cli first (the board 
+# must match --mcu), with the kernel options in BUILD_FLAGS.  The sketch prints "BENCH <name> <param> <cycles>" 
+# lines on the UART, which simavr echoes; they are collected until 
+# "BENCH done" and written out as
+#
+#    {"mcu": ..., "f_cpu": ..., "commit": ...,
+#     "results": {"yield": {"round": 123}, "sleep_wake": {...}, ...}}
+#
+# so runs on different commits can be compared with --compare.
+
+# This file is part of ARTK - Arduino Real-Time Kernel, and is distributed
+# under the terms of the GNU General Public License, version 3 or later.
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import threading
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.dirname(os.path.dirname(HERE))
+SKETCH = os.path.join(REPO, 'examples', 'ARTKbench')
+
+# the optional kernel pools the benchmarks use
+BUILD_FLAGS = '-DMAX_TIMERS=8 -DDEFER_SIZE=8'
+
+LINE = re.compile(r'BENCH (\S+)(?: (\S+) (\d+))?')
+ANSI = re.compile(r'\x1b\[[0-9;]*m')
+
+
+def build(fqbn):
+    out = tempfile.mkdtemp(prefix='artkbench')
+    subprocess.check_call(['arduino-cli', 'compile', '--fqbn', fqbn,
+                           '--build-property',
+                           'compiler.cpp.extra_flags=' + BUILD_FLAGS,
+                           '--library', REPO, '--output-dir', out, SKETCH])
+    return os.path.join(out, 'ARTKbench.ino.elf')
+
+
+def run(simavr, elf, mcu, freq, timeout):
+    proc = subprocess.Popen([simavr, '-m', mcu, '-f', str(freq), elf],
+                            stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True)
+    results = {}
+    done = False
+    timer = None
+    try:
+        timer = threading.Timer(timeout, proc.kill)
+        timer.start()
+        for raw in proc.stdout:
+            m = LINE.search(ANSI.sub('', raw))
+            if not m:
+                continue
+            if m.group(1) == 'done':
+                done = True
+                break
+            # a result line cut short, say by the timeout
+            if m.group(3) is None:
+                continue
+            results.setdefault(m.group(1), {})[m.group(2)] = int(m.group(3))
+    finally:
+        if timer is not None:
+            timer.cancel()
+        proc.kill()
+        proc.wait()
+    if not done:
+        sys.exit('simavr stopped before the benchmark finished')
+    return results
+
+
+def commit():
+    try:
+        return subprocess.check_output(['git', '-C', REPO, 'rev-parse',
+                                        '--short', 'HEAD'],
+                                       universal_newlines=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def compare(old, new):
+    for name in sorted(new):
+        for param in sorted(new[name]):
+            after = new[name][param]
+            before = old.get(name, {}).get(param)
+            if before is None:
+                change = 'new'
+            elif before == 0:
+                change = 'was 0'
+            else:
+                change = '%+.1f%%' % (100.0 * (after - before) / before)
+            print('%-12s %-6s %8s %8d  %s' % (name, param,
+                  before if before is not None else '-', after, change))
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Run ARTKbench under simavr')
+    ap.add_argument('--elf', help='built ARTKbench firmware')
+    ap.add_argument('--build', action='store_true',
+                    help='build the sketch with arduino-cli')
+    ap.add_argument('--fqbn', default='arduino:avr:uno')
+    ap.add_argument('--mcu', default='atmega328p')
+    ap.add_argument('--freq', type=int, default=16000000)
+    ap.add_argument('--simavr', default='simavr')
+    ap.add_argument('--timeout', type=float, default=60.0,
+                    help='seconds of host time to allow')
+    ap.add_argument('--compare', help='earlier results to compare against')
+    ap.add_argument('-o', '--output', help='JSON file (default stdout)')
+    args = ap.parse_args()
+
+    elf = build(args.fqbn) if args.build else args.elf
+    if not elf:
+        ap.error('give --elf or --build')
+
+    report = {'mcu': args.mcu, 'f_cpu': args.freq, 'commit': commit(),
+              'results': run(args.simavr, elf, args.mcu, args.freq,
+                             args.timeout)}
+
+    if args.output:
+        with open(args.output, 'w') as f:
+            json.dump(report, f, indent=2, sort_keys=True)
+    else:
+        json.dump(report, sys.stdout, indent=2, sort_keys=True)
+        print()
+
+    if args.compare:
+        with open(args.compare) as f:
+            compare(json.load(f)['results'], report['results'])
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,121 @@
+// ARTK  extras/host/Arduino.h
+// The little of the Arduino core that ARTK uses, for running the kernel as
+// an ordinary Linux program (see machine_host.cpp).
+//
+// There is no real hardware underneath, so time is virtual: a CPU cycle
+// counter at F_CPU that only moves when a task says it is doing work
+// (HostBusy, delay), or when the processor idles and skips ahead to the
+// next interrupt.  Kernel code itself takes no time unless
+// HostSetCallCycles says otherwise.  The results are therefore exactly
+// repeatable, and a second of virtual time takes as long as the scheduler
+// needs to get through it.
+//
+// Interrupts are polled.  The I bit in SREG is kept as a flag, and an
+// interrupt that fell due while it was clear is taken as soon as it is
+// set again, or as soon as time moves on with it set.
+
+/******* License ***********************************************************
+  This file is part of ARTK - Arduino Real-Time Kernel
+
+  ARTK is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ARTK is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ARTK.  If not, see <http://www.gnu.org/licenses/>.
+****************************************************************************/
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef F_CPU
+	#define F_CPU 16000000UL
+#endif
+
+#define PROGMEM
+#define pgm_read_byte(addr)  (*(const unsigned char *)(addr))
+#define _BV(bit)             (1 << (bit))
+
+#define SREG_I  0x80
+
+// Processor status - only the I bit means anything
+class HostSREG
+{
+public:
+	operator unsigned char() const ;
+	HostSREG &operator=(unsigned char value) ;
+} ;
+extern HostSREG SREG ;
+
+void cli() ;
+void sei() ;
+#define noInterrupts() cli()
+#define interrupts()   sei()
+
+unsigned long millis() ;
+unsigned long micros() ;
+void delay(unsigned long ms) ;
+void delayMicroseconds(unsigned int us) ;
+
+// Serial output goes to stdout
+class HostSerial
+{
+public:
+	void begin(unsigned long baud) { (void)baud ; }
+	void flush() { fflush(stdout) ; }
+	size_t write(unsigned char c) ;
+	size_t write(const unsigned char *buf, size_t size) ;
+	void print(const char *s) ;
+	void print(char c) ;
+	void print(long n) ;
+	void print(unsigned long n) ;
+	void print(int n) { print((long)n) ; }
+	void print(unsigned int n) { print((unsigned long)n) ; }
+	void println() ;
+	void println(const char *s) { print(s) ; println() ; }
+	void println(char c) { print(c) ; println() ; }
+	void println(long n) { print(n) ; println() ; }
+	void println(unsigned long n) { print(n) ; println() ; }
+	void println(int n) { print(n) ; println() ; }
+	void println(unsigned int n) { print(n) ; println() ; }
+} ;
+extern HostSerial Serial ;
+
+// Host only - see machine_host.cpp
+
+// Virtual CPU cycles since the program started
+unsigned long long HostCycles() ;
+
+// The calling task does cycles worth of work.  Interrupts that fall due
+// meanwhile are taken (if enabled), so it can be preempted part way.
+void HostBusy(unsigned long cycles) ;
+
+// Charges every return from the kernel (each time interrupts are enabled)
+// with cycles of virtual time, as a crude model of the cost of the kernel.
+void HostSetCallCycles(unsigned long cycles) ;
+
+// Calls isr every period cycles from now on, like a timer interrupt.
+// period 0 detaches it.  Returns FALSE if all HOST_MAX_IRQS are in use.
+#define HOST_MAX_IRQS 4
+char HostAttachInterrupt(void (*isr)(), unsigned long period) ;
+void HostDetachInterrupt(void (*isr)()) ;
+
+// Ends the program once virtual time reaches cycles (0 for never)
+void HostSetLimit(unsigned long long cycles) ;
+
+// the sketch
+void setup() ;
+void loop() ;
+
+#endif
@@ -0,0 +1,40 @@
+#!/bin/sh
+# build.sh - builds a sketch as a Linux program, on the host machine layer
+#
+#    build.sh [-o program] sketch.cpp [more sources] [-- compiler flags]
+#
+# A sketch file is plain C++ (an .ino can be passed too, it is compiled as
+# C++ with <Arduino.h> in scope).  Flags after -- go to g++, for example
+#    build.sh stress.cpp -- -O2 -g -DARTK_STATS
+# for a build to run under perf.  The default is -O2.
+
+# This file is part of ARTK - Arduino Real-Time Kernel, and is distributed
+# under the terms of the GNU General Public License, version 3 or later.
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+REPO=$(cd "$HERE/../.." && pwd)
+OUT=
+SOURCES=
+
+while [ $# -gt 0 ]; do
+   case "$1" in
+      -o) OUT=$2; shift 2 ;;
+      --) shift; break ;;
+      *)  SOURCES="$SOURCES $1"; shift ;;
+   esac
+done
+
+if [ -z "$SOURCES" ]; then
+   echo "usage: build.sh [-o program] sketch.cpp [sources] [-- g++ flags]" >&2
+   exit 2
+fi
+if [ -z "$OUT" ]; then
+   OUT=${SOURCES# }
+   OUT=$(basename "${OUT%% *}")
+   OUT=${OUT%.*}
+fi
+[ $# -eq 0 ] && set -- -O2
+
+exec ${CXX:-g++} -Wall -I"$HERE" -I"$REPO" "$@" -o "$OUT" \
+     -x c++ -include Arduino.h $SOURCES -x none \
+     "$REPO/kernel.cpp" "$HERE/machine_host.cpp"
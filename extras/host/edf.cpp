@@ -0,0 +1,98 @@
+// edf.cpp - deadline scheduling of a periodic task set on the host build
+//
+//    extras/host/build.sh extras/host/edf.cpp -- -O2 -DARTK_EDF
+//    EDF_UTIL=100 ./edf
+//    EDF_UTIL=100 EDF_MODE=rm ./edf
+//
+// Four periodic tasks with periods of 5, 7, 11 and 13 ticks, each with its
+// period as its deadline, share EDF_UTIL percent of the CPU (default 100)
+// in proportion to their periods.  They run for EDF_SECONDS virtual
+// seconds (default 30), scheduled earliest deadline first at one priority,
+// or with EDF_MODE=rm at rate monotonic priorities (shorter period, higher
+// priority) for comparison.  Prints the jobs and deadline misses of each
+// task; under EDF there should be none up to 100%.
+
+#include <ARTK.h>
+
+#ifndef ARTK_EDF
+	#error "build with -DARTK_EDF"
+#endif
+
+#define PERIODIC  4
+#define CYCLES_PER_TICK  (F_CPU / 1000)
+
+static const unsigned int periods[PERIODIC] = { 5, 7, 11, 13 } ;
+static TASK tasks[PERIODIC] ;
+static unsigned long jobs[PERIODIC] ;
+static unsigned long work[PERIODIC] ;
+static unsigned long lateStarts[PERIODIC] ;
+static unsigned long seconds = 30 ;
+static unsigned long util = 100 ;
+static char rm = FALSE ;
+
+// the task finds out which one it is from its handle
+static unsigned char self()
+{
+   unsigned char i = 0 ;
+
+   while (tasks[i] != Scheduler::InstancePtr->activeTask)
+      i++ ;
+   return i ;
+}
+
+void Periodic()
+{
+   unsigned char me = self() ;
+   unsigned long last = ARTK_GetTicks() ;
+
+   while (TRUE)
+   {
+      HostBusy(work[me]) ;
+      jobs[me]++ ;
+      // the next job starts at once if it is due already
+      if (!ARTK_SleepUntil(&last, periods[me]))
+         lateStarts[me]++ ;
+   }
+}
+
+void Report()
+{
+   unsigned long misses, total = 0 ;
+   unsigned char i ;
+
+   ARTK_Sleep(seconds * 1000) ;
+   printf("%s at %lu%% for %lu s\n", rm ? "rate monotonic" : "EDF", util,
+          seconds) ;
+   for (i = 0; i < PERIODIC; i++)
+   {
+      misses = ARTK_GetDeadlineMisses(tasks[i]) ;
+      total += misses ;
+      printf("period %2u  jobs %6lu  misses %6lu  late starts %6lu\n",
+             periods[i], jobs[i], misses, lateStarts[i]) ;
+   }
+   printf("misses   %lu\n", total) ;
+   fflush(stdout) ;
+   exit(0) ;
+}
+
+void SetupARTK()
+{
+   const char *arg ;
+   unsigned char i ;
+
+   if ((arg = getenv("EDF_UTIL")) != NULL)
+      util = strtoul(arg, NULL, 10) ;
+   if ((arg = getenv("EDF_SECONDS")) != NULL)
+      seconds = strtoul(arg, NULL, 10) ;
+   if ((arg = getenv("EDF_MODE")) != NULL)
+      rm = strcmp(arg, "rm") == 0 ;
+
+   for (i = 0; i < PERIODIC; i++)
+   {
+      // each takes an equal share of the utilization
+      work[i] = CYCLES_PER_TICK * periods[i] * util / (100 * PERIODIC) ;
+      tasks[i] = ARTK_CreateTask(Periodic, DEFAULT_STACK, rm ? 8 - i : 8) ;
+      ARTK_SetDeadline(tasks[i], periods[i]) ;
+   }
+   ARTK_CreateTask(Report, DEFAULT_STACK, MAX_PRIORITY) ;
+}
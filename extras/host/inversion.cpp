@@ -0,0 +1,230 @@
+// inversion.cpp - priority inversion check for the host build of ARTK
+//
+//    extras/host/build.sh extras/host/inversion.cpp
+//    ./inversion
+//    INVERSION_LOCK=semaphore ./inversion
+//
+// A low priority task takes a lock for HOLD_TICKS at a time, a high
+// priority task needs the same lock now and then, and a medium priority
+// task in between burns MEDIUM_TICKS of CPU at a time.  With a mutex the
+// low task inherits the high priority while the high task waits, so the
+// medium task can't hold it off, and the high task never waits much
+// longer than HOLD_TICKS.  Then the same again through a chain of two
+// locks: the high task waits for one held by a middle task, which waits
+// for one held by the low task, so the low task must inherit through the
+// middle one.  Last, the chain is built once more and the high task is
+// deleted while it waits, and the middle and low tasks must both drop
+// back to the middle task's priority.
+//
+// Each case runs for INVERSION_SECONDS virtual seconds (default 30).  It
+// prints the worst waits, and exits with 1 if one went over its bound or
+// a priority was wrong.  INVERSION_LOCK=semaphore uses binary semaphores,
+// which have no inheritance, to show the unbounded inversion the mutexes
+// prevent.
+
+#include <ARTK.h>
+
+#define CYCLES_PER_TICK  (F_CPU / 1000)
+#define HOLD_TICKS       2
+#define MEDIUM_TICKS     20
+#define LOW_PRIO         2
+#define MIDDLE_PRIO      4
+#define MEDIUM_PRIO      6
+#define HIGH_PRIO        10
+// what the high task may wait - the rest of a hold (or of two, through
+// the chain), plus a tick for the others' bookkeeping
+#define BOUND_CYCLES       ((HOLD_TICKS + 1) * CYCLES_PER_TICK)
+#define CHAIN_BOUND_CYCLES ((2 * HOLD_TICKS + 1) * CYCLES_PER_TICK)
+
+static MUTEX mutex[2] ;
+static SEMAPHORE sema[2] ;
+static char useMutex = TRUE ;
+static unsigned long seconds = 30 ;
+static unsigned long waits, contended ;
+static unsigned long long worstWait ;
+// ends a case - the tasks return once they hold no lock
+static volatile char stop ;
+
+static void lock(unsigned char i)
+{
+   if (useMutex)
+      ARTK_LockMutex(mutex[i]) ;
+   else
+      ARTK_Wait(sema[i]) ;
+}
+
+static void unlock(unsigned char i)
+{
+   if (useMutex)
+      ARTK_UnlockMutex(mutex[i]) ;
+   else
+      ARTK_Signal(sema[i]) ;
+}
+
+// holds the lock the high task waits on, or the end of the chain
+void Low()
+{
+   while (!stop)
+   {
+      lock(1) ;
+      HostBusy(HOLD_TICKS * CYCLES_PER_TICK) ;
+      unlock(1) ;
+      ARTK_Sleep(1) ;
+   }
+}
+
+// the middle of the chain
+void Middle()
+{
+   while (!stop)
+   {
+      lock(0) ;
+      lock(1) ;
+      HostBusy(HOLD_TICKS * CYCLES_PER_TICK) ;
+      unlock(1) ;
+      unlock(0) ;
+      ARTK_Sleep(3) ;
+   }
+}
+
+void Medium()
+{
+   while (!stop)
+   {
+      ARTK_Sleep(13) ;
+      HostBusy(MEDIUM_TICKS * CYCLES_PER_TICK) ;
+   }
+}
+
+// the lock the high task times its waits for
+static unsigned char highLock ;
+
+void High()
+{
+   unsigned long long start, wait ;
+
+   while (!stop)
+   {
+      ARTK_Sleep(7) ;
+      start = HostCycles() ;
+      lock(highLock) ;
+      wait = HostCycles() - start ;
+      unlock(highLock) ;
+      waits++ ;
+      if (wait > 0)
+         contended++ ;
+      if (wait > worstWait)
+         worstWait = wait ;
+   }
+}
+
+// Runs the tasks for a while, then ends them.  Returns TRUE if the high
+// task had to wait, and never for longer than bound.
+static char runCase(const char *name, char chain, unsigned long bound)
+{
+   TASK tasks[4] ;
+   unsigned char n = 0 ;
+   char ok ;
+
+   waits = contended = 0 ;
+   worstWait = 0 ;
+   stop = FALSE ;
+   highLock = chain ? 0 : 1 ;
+   tasks[n++] = ARTK_CreateTask(Low, DEFAULT_STACK, LOW_PRIO) ;
+   if (chain)
+      tasks[n++] = ARTK_CreateTask(Middle, DEFAULT_STACK, MIDDLE_PRIO) ;
+   tasks[n++] = ARTK_CreateTask(Medium, DEFAULT_STACK, MEDIUM_PRIO) ;
+   tasks[n++] = ARTK_CreateTask(High, DEFAULT_STACK, HIGH_PRIO) ;
+   ARTK_Sleep(seconds * 1000) ;
+   stop = TRUE ;
+   while (n > 0)
+      ARTK_Join(tasks[--n]) ;
+
+   // the check means nothing unless the high task really had to wait
+   ok = contended != 0 && worstWait <= bound ;
+   printf("%-8s waits %6lu (%5lu contended), worst %7llu cycles "
+          "(bound %lu)\n", name, waits, contended, worstWait, bound) ;
+   return ok ;
+}
+
+// holds the end of the chain until it is deleted
+void Holder()
+{
+   lock(1) ;
+   while (TRUE)
+      HostBusy(CYCLES_PER_TICK) ;
+}
+
+void Waiter()
+{
+   lock(0) ;
+   lock(1) ;
+}
+
+void Waiter2()
+{
+   lock(0) ;
+}
+
+// Builds the chain Waiter2 -> Waiter -> Holder, then deletes the head
+// of it while it waits.  Returns TRUE if the boost went down the chain
+// and came back off it.
+static char deboostCase()
+{
+   TASK holder, waiter, top ;
+   unsigned boosted, middle, low ;
+
+   holder = ARTK_CreateTask(Holder, DEFAULT_STACK, LOW_PRIO) ;
+   ARTK_Sleep(1) ;
+   waiter = ARTK_CreateTask(Waiter, DEFAULT_STACK, MIDDLE_PRIO) ;
+   ARTK_Sleep(1) ;
+   top = ARTK_CreateTask(Waiter2, DEFAULT_STACK, HIGH_PRIO) ;
+   ARTK_Sleep(1) ;
+   boosted = ARTK_GetPriority(holder) ;
+   ARTK_DeleteTask(top) ;
+   middle = ARTK_GetPriority(waiter) ;
+   low = ARTK_GetPriority(holder) ;
+   // the holder is deleted with the chain's mutex, which goes to the
+   // waiter, and then the waiter with both
+   ARTK_DeleteTask(holder) ;
+   ARTK_DeleteTask(waiter) ;
+
+   printf("deboost  holder at %u, after the delete %u (waiter %u)\n",
+          boosted, low, middle) ;
+   return boosted == HIGH_PRIO && middle == MIDDLE_PRIO &&
+          low == MIDDLE_PRIO ;
+}
+
+void Report()
+{
+   char failed = FALSE ;
+
+   printf("%s, %lu s a case\n", useMutex ? "mutex" : "semaphore", seconds) ;
+   failed |= !runCase("single", FALSE, BOUND_CYCLES) ;
+   failed |= !runCase("chain", TRUE, CHAIN_BOUND_CYCLES) ;
+   if (useMutex)
+      failed |= !deboostCase() ;
+   printf("%s\n", failed ? "FAILED" : "ok") ;
+   fflush(stdout) ;
+   exit(failed) ;
+}
+
+void SetupARTK()
+{
+   const char *arg ;
+   unsigned char i ;
+
+   if ((arg = getenv("INVERSION_SECONDS")) != NULL)
+      seconds = strtoul(arg, NULL, 10) ;
+   arg = getenv("INVERSION_LOCK") ;
+   useMutex = arg == NULL || strcmp(arg, "semaphore") != 0 ;
+   for (i = 0; i < 2; i++)
+   {
+      if (useMutex)
+         mutex[i] = ARTK_CreateMutex() ;
+      else
+         sema[i] = ARTK_CreateSemaphore(1) ;
+   }
+
+   ARTK_CreateTask(Report, DEFAULT_STACK, MAX_PRIORITY) ;
+}
@@ -0,0 +1,452 @@
+// ARTK  extras/host/machine_host.cpp
+// The machine layer (machine.h) for Linux, so the kernel can run as an
+// ordinary program - for stress tests, and for profiling the scheduler
+// with perf or gprof before going near a board.  build.sh builds a sketch
+// with it.
+//
+// Tasks are ucontexts.  What the kernel keeps as a task's stack pointer
+// is the address of a HostFrame at the top of its stack, which holds the
+// context it was switched out in.  Timer1 is replaced by a virtual timer
+// on the cycle clock described in Arduino.h, which keeps the AVR tick's
+// behaviour (stretching while idle included), so the kernel can't tell
+// the difference.
+
+/******* License ***********************************************************
+  This file is part of ARTK - Arduino Real-Time Kernel
+
+  ARTK is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ARTK is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with ARTK.  If not, see <http://www.gnu.org/licenses/>.
+****************************************************************************/
+
+#include  <Arduino.h>
+#include  <ucontext.h>
+#include "machine.h"
+
+struct HostFrame
+{
+   ucontext_t ctx ;
+   void (*root)() ;
+   void (*done)() ;
+} ;
+
+// main() runs on this until the first task is switched in
+static HostFrame mainFrame ;
+// the context that is running
+static HostFrame *hostCurrent = &mainFrame ;
+
+// the interrupt flag and the virtual clock
+static char hostI = 0 ;
+static unsigned long long hostNow = 0 ;
+static unsigned long long hostLimit = 0 ;
+static unsigned long callCycles = 0 ;
+
+HostSREG SREG ;
+HostSerial Serial ;
+
+// Virtual Timer1 - as on the AVR it counts at clk/64.  The compare period
+// began at periodStart and covers tickStretch ticks.
+#define TICK_PRESCALE        64
+#define TICK_COUNTS_PER_MS   (F_CPU / TICK_PRESCALE / 1000)
+
+static char tickRunning = 0 ;
+static unsigned int tickCounts = TICK_COUNTS_PER_MS ;
+static unsigned int tickStretch = 1 ;
+static unsigned long long periodStart = 0 ;
+
+struct HostIrq
+{
+   void (*isr)() ;
+   unsigned long period ;
+   unsigned long long due ;
+} ;
+
+static HostIrq irqs[HOST_MAX_IRQS] ;
+
+static unsigned long long compareAt()
+{
+   return periodStart +
+          (unsigned long long)tickStretch * tickCounts * TICK_PRESCALE ;
+}
+
+static char tickPending()
+{
+   return tickRunning && hostNow >= compareAt() ;
+}
+
+// the time of the next interrupt, or 0 if there is nothing to come
+static unsigned long long nextEvent()
+{
+   unsigned long long next = tickRunning ? compareAt() : 0 ;
+   unsigned char i ;
+
+   for (i = 0; i < HOST_MAX_IRQS; i++)
+      if (irqs[i].isr != NULL && (next == 0 || irqs[i].due < next))
+         next = irqs[i].due ;
+   return next ;
+}
+
+static void advance(unsigned long long to)
+{
+   if (hostLimit != 0 && to >= hostLimit)
+   {
+      fflush(stdout) ;
+      exit(0) ;
+   }
+   hostNow = to ;
+}
+
+// The tick interrupt.  The interrupted context is the "frame" handed to
+// the kernel, and if another task is to run it is switched out right here,
+// to carry on from this point when it is resumed.
+static void takeTick()
+{
+   unsigned int ticks = tickStretch ;
+   HostFrame *from = hostCurrent ;
+   HostFrame *to ;
+
+   periodStart = compareAt() ;
+   tickStretch = 1 ;
+   hostI = 0 ;
+   to = (HostFrame *)KernelTick((unsigned char *)from, ticks) ;
+   if (to != from)
+   {
+      hostCurrent = to ;
+      swapcontext(&from->ctx, &to->ctx) ;
+   }
+   hostI = 1 ;
+}
+
+// Takes whatever interrupts are due, tick first.  Interrupts must be
+// enabled.
+static void takeInterrupts()
+{
+   unsigned char i ;
+   char taken = 1 ;
+
+   while (taken)
+   {
+      taken = 0 ;
+      if (tickPending())
+      {
+         takeTick() ;
+         taken = 1 ;
+      }
+      for (i = 0; i < HOST_MAX_IRQS; i++)
+      {
+         if (irqs[i].isr != NULL && hostNow >= irqs[i].due)
+         {
+            irqs[i].due += irqs[i].period ;
+            hostI = 0 ;
+            irqs[i].isr() ;
+            hostI = 1 ;
+            taken = 1 ;
+         }
+      }
+   }
+}
+
+HostSREG::operator unsigned char() const
+{
+   return hostI ? SREG_I : 0 ;
+}
+
+HostSREG &HostSREG::operator=(unsigned char value)
+{
+   if (value & SREG_I)
+      sei() ;
+   else
+      hostI = 0 ;
+   return *this ;
+}
+
+void cli()
+{
+   hostI = 0 ;
+}
+
+void sei()
+{
+   hostI = 1 ;
+   if (callCycles != 0)
+      HostBusy(callCycles) ;
+   else
+      takeInterrupts() ;
+}
+
+unsigned long long HostCycles()
+{
+   return hostNow ;
+}
+
+void HostBusy(unsigned long cycles)
+{
+   unsigned long long next ;
+
+   while (1)
+   {
+      if (hostI)
+         takeInterrupts() ;
+      next = nextEvent() ;
+      if (!hostI || next == 0 || next - hostNow > cycles)
+         break ;
+      cycles -= next - hostNow ;
+      advance(next) ;
+   }
+   advance(hostNow + cycles) ;
+   if (hostI)
+      takeInterrupts() ;
+}
+
+void HostSetCallCycles(unsigned long cycles)
+{
+   callCycles = cycles ;
+}
+
+char HostAttachInterrupt(void (*isr)(), unsigned long period)
+{
+   unsigned char i ;
+
+   if (period == 0)
+   {
+      HostDetachInterrupt(isr) ;
+      return 1 ;
+   }
+   for (i = 0; i < HOST_MAX_IRQS; i++)
+   {
+      if (irqs[i].isr == NULL || irqs[i].isr == isr)
+      {
+         irqs[i].period = period ;
+         irqs[i].due = hostNow + period ;
+         irqs[i].isr = isr ;
+         return 1 ;
+      }
+   }
+   return 0 ;
+}
+
+void HostDetachInterrupt(void (*isr)())
+{
+   unsigned char i ;
+
+   for (i = 0; i < HOST_MAX_IRQS; i++)
+      if (irqs[i].isr == isr)
+         irqs[i].isr = NULL ;
+}
+
+void HostSetLimit(unsigned long long cycles)
+{
+   hostLimit = cycles ;
+}
+
+unsigned long millis()
+{
+   return (unsigned long)(hostNow / (F_CPU / 1000)) ;
+}
+
+unsigned long micros()
+{
+   return (unsigned long)(hostNow / (F_CPU / 1000000)) ;
+}
+
+void delay(unsigned long ms)
+{
+   HostBusy(ms * (F_CPU / 1000)) ;
+}
+
+void delayMicroseconds(unsigned int us)
+{
+   HostBusy(us * (F_CPU / 1000000)) ;
+}
+
+size_t HostSerial::write(unsigned char c)
+{
+   putchar(c) ;
+   return 1 ;
+}
+
+size_t HostSerial::write(const unsigned char *buf, size_t size)
+{
+   return fwrite(buf, 1, size, stdout) ;
+}
+
+void HostSerial::print(const char *s)
+{
+   fputs(s, stdout) ;
+}
+
+void HostSerial::print(char c)
+{
+   putchar(c) ;
+}
+
+void HostSerial::print(long n)
+{
+   printf("%ld", n) ;
+}
+
+void HostSerial::print(unsigned long n)
+{
+   printf("%lu", n) ;
+}
+
+void HostSerial::println()
+{
+   putchar('\n') ;
+}
+
+// machine.h
+
+// new tasks start here, with interrupts enabled as they would be after
+// the AVR switch code returns into the root function
+static void taskEntry()
+{
+   HostFrame *self = hostCurrent ;
+
+   sei() ;
+   self->root() ;
+   self->done() ;
+}
+
+unsigned char *InitialFrame(unsigned char *base, unsigned int size,
+                            void (*root)(), void (*done)(), char largeModel)
+{
+   uintptr_t top = (uintptr_t)(base + size - sizeof(HostFrame)) & ~(uintptr_t)15 ;
+   HostFrame *frame = (HostFrame *)top ;
+
+   (void)largeModel ;
+   frame->root = root ;
+   frame->done = done ;
+   getcontext(&frame->ctx) ;
+   frame->ctx.uc_stack.ss_sp = base ;
+   frame->ctx.uc_stack.ss_size = (unsigned char *)frame - base ;
+   frame->ctx.uc_link = NULL ;
+   makecontext(&frame->ctx, taskEntry, 0) ;
+   return (unsigned char *)frame ;
+}
+
+void ContextSwitch(unsigned char **fromSP, unsigned char *toSP)
+{
+   HostFrame *from = hostCurrent ;
+
+   *fromSP = (unsigned char *)from ;
+   hostCurrent = (HostFrame *)toSP ;
+   swapcontext(&from->ctx, &hostCurrent->ctx) ;
+   // resumed, by a switch or by the tick
+   sei() ;
+}
+
+void FirstSwitch(unsigned char *toSP)
+{
+   hostCurrent = (HostFrame *)toSP ;
+   setcontext(&hostCurrent->ctx) ;
+}
+
+unsigned char *StackPointer()
+{
+   return (unsigned char *)__builtin_frame_address(0) ;
+}
+
+void TickStart(unsigned long usec)
+{
+   unsigned long counts = usec * TICK_COUNTS_PER_MS / 1000 ;
+
+   if (counts == 0)
+      counts = 1 ;
+   else if (counts > 0xFFFFUL)
+      counts = 0xFFFFUL ;
+
+   tickCounts = (unsigned int)counts ;
+   tickStretch = 1 ;
+   periodStart = hostNow ;
+   tickRunning = 1 ;
+}
+
+void TickStretch(unsigned long ticks)
+{
+   unsigned long most = 0x10000UL / tickCounts ;
+
+   // already stretched, or a tick is pending and will be taken first
+   if (tickStretch != 1 || tickPending())
+      return ;
+   if (ticks == 0 || ticks > most)
+      ticks = most ;
+   if (ticks < 2)
+      return ;
+   tickStretch = (unsigned int)ticks ;
+}
+
+unsigned int TickResume()
+{
+   unsigned int ticks ;
+
+   // if the stretched tick is pending its interrupt will report it
+   if (tickStretch == 1 || tickPending())
+      return 0 ;
+   ticks = TickPhase() / tickCounts ;
+   periodStart += (unsigned long long)ticks * tickCounts * TICK_PRESCALE ;
+   tickStretch = 1 ;
+   return ticks ;
+}
+
+// the counter clears at the compare, so a pending tick starts it again
+unsigned int TickPhase()
+{
+   unsigned long long count = (hostNow - periodStart) / TICK_PRESCALE ;
+
+   return (unsigned int)(count % ((unsigned long)tickStretch * tickCounts)) ;
+}
+
+unsigned long TickCycles(unsigned long ticks, unsigned int phase)
+{
+   return (ticks * tickCounts + phase) * TICK_PRESCALE ;
+}
+
+unsigned int TickStamp(unsigned long *ticks)
+{
+   if (tickPending())
+      *ticks += tickStretch ;
+   return TickPhase() ;
+}
+
+unsigned long CycleCount(unsigned long ticks)
+{
+   unsigned int phase = TickStamp(&ticks) ;
+
+   return TickCycles(ticks, phase) ;
+}
+
+// skips ahead to the next interrupt and takes it
+void IdleSleep(char deep)
+{
+   unsigned long long next = nextEvent() ;
+
+   (void)deep ;
+   if (next == 0)
+   {
+      // nothing can ever wake us
+      fflush(stdout) ;
+      exit(0) ;
+   }
+   if (next > hostNow)
+      advance(next) ;
+   hostI = 1 ;
+   takeInterrupts() ;
+   hostI = 0 ;
+}
+
+int main()
+{
+   setup() ;
+   while (1)
+      loop() ;
+}
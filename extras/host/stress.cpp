@@ -0,0 +1,186 @@
+// stress.cpp - a scheduler workout for the host build of ARTK
+//
+//    cd extras/host
+//    ./build.sh stress.cpp -- -O2 -DMAX_THREAD_LIST=13 -DDEFER_SIZE=8
+//    STRESS_SECONDS=10 ./stress
+//
+// Runs for STRESS_SECONDS virtual seconds (default 60) with:
+//    sleepers  tasks at several priorities doing a little work and sleeping
+//              a varying number of ticks, checking they never wake early
+//    yielders  two tasks at one priority handing over with ARTK_Yield
+//    isr       a simulated interrupt signalling a waiting task
+//    defer     another one deferring calls to the defer worker
+//    hogs      two tasks at the yielders' priority that never yield, shared
+//              out by a HOG_SLICE tick time slice, checking they get an 
+//              even share (to 5%)
+// and prints the counts, the worst wakeup lateness, and how many kernel
+// operations per second of real time it got through.  It exits with 1 if
+// a check failed.
+
+#include <ARTK.h>
+#include <time.h>
+
+#define SLEEPERS  6
+#define TASKS     (SLEEPERS + 7)
+#define HOG_PRIO  2
+#define HOG_SLICE 5
+
+#if MAX_THREAD_LIST < TASKS
+	#error "build with -DMAX_THREAD_LIST=13 (or more)"
+#endif
+#if DEFER_SIZE == 0
+	#error "build with -DDEFER_SIZE=8"
+#endif
+
+static unsigned long seconds = 60 ;
+static unsigned long sleeps, early, worstLate ;
+static unsigned long yields ;
+static unsigned long irqs, isrWakes ;
+static unsigned long deferred, deferRuns ;
+static SEMAPHORE isrSema ;
+static unsigned long hogWork[2], handovers ;
+static unsigned char lastHog ;
+
+void Sleeper()
+{
+   unsigned int n = 1 ;
+   unsigned long due ;
+   unsigned long late ;
+
+   while (TRUE)
+   {
+      HostBusy(2000 + 500 * n) ;
+      due = ARTK_GetTicks() + n ;
+      ARTK_Sleep(n) ;
+      late = ARTK_GetTicks() - due ;
+      if ((long)late < 0)
+         early++ ;
+      else if (late > worstLate)
+         worstLate = late ;
+      sleeps++ ;
+      n = n % 7 + 1 ;
+   }
+}
+
+void Yielder()
+{
+   while (TRUE)
+   {
+      HostBusy(300) ;
+      yields++ ;
+      ARTK_Yield() ;
+   }
+}
+
+// never gives up the processor, so only the time slice lets the other in
+void Hog()
+{
+   static unsigned char hogs ;
+   unsigned char me = hogs++ ;
+
+   while (TRUE)
+   {
+      HostBusy(1000) ;
+      hogWork[me]++ ;
+      if (lastHog != me)
+      {
+         lastHog = me ;
+         handovers++ ;
+      }
+   }
+}
+
+void Irq()
+{
+   irqs++ ;
+   ARTK_SignalFromISR(isrSema) ;
+   ARTK_YieldFromISR() ;
+}
+
+void Deferred(void *arg)
+{
+   // runs in order, so the argument is the count so far
+   if ((unsigned long)arg == deferRuns)
+      deferRuns++ ;
+}
+
+void DeferIrq()
+{
+   ARTK_DeferFromISR(Deferred, (void *)deferred++) ;
+   ARTK_YieldFromISR() ;
+}
+
+void IsrWaiter()
+{
+   while (TRUE)
+   {
+      ARTK_Wait(isrSema) ;
+      isrWakes++ ;
+      HostBusy(100) ;
+   }
+}
+
+static double now()
+{
+   struct timespec ts ;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts) ;
+   return ts.tv_sec + ts.tv_nsec / 1e9 ;
+}
+
+void Report()
+{
+   double start = now() ;
+   double real ;
+   unsigned long ops ;
+   char failed ;
+
+   ARTK_Sleep(seconds * 1000) ;
+   real = now() - start ;
+   HostDetachInterrupt(Irq) ;
+   HostDetachInterrupt(DeferIrq) ;
+
+   // every interrupt wakes the waiter unless it was already signalled
+   failed = early != 0 || isrWakes + 1 < irqs ;
+   failed |= deferRuns != deferred || ARTK_DeferOverflows() != 0 ;
+   // the hogs get the same CPU time, give or take what the higher 
+   // priorities took out of their slices
+   failed |= labs((long)(hogWork[0] - hogWork[1])) * 20 > 
+             (long)(hogWork[0] + hogWork[1]) ;
+   ops = sleeps + yields + isrWakes + handovers + deferRuns ;
+   printf("virtual  %lu s, %lu ticks\n", seconds, ARTK_GetTicks()) ;
+   printf("sleeps   %lu (%lu early, worst %lu ticks late)\n",
+          sleeps, early, worstLate) ;
+   printf("yields   %lu\n", yields) ;
+   printf("isr      %lu interrupts, %lu wakeups\n", irqs, isrWakes) ;
+   printf("defer    %lu deferred, %lu run\n", deferred, deferRuns) ;
+   printf("hogs     %lu / %lu, %lu handovers\n", hogWork[0], hogWork[1],
+          handovers) ;
+   printf("real     %.3f s, %.0f kernel operations/s\n", real, ops / real) ;
+   printf("%s\n", failed ? "FAILED" : "ok") ;
+   fflush(stdout) ;
+   exit(failed) ;
+}
+
+void SetupARTK()
+{
+   unsigned char i ;
+   const char *arg = getenv("STRESS_SECONDS") ;
+
+   if (arg != NULL)
+      seconds = strtoul(arg, NULL, 10) ;
+   isrSema = ARTK_CreateSemaphore(0) ;
+   for (i = 0; i < SLEEPERS; i++)
+      ARTK_CreateTask(Sleeper, DEFAULT_STACK, 4 + 2 * i) ;
+   ARTK_CreateTask(Yielder, DEFAULT_STACK, HOG_PRIO) ;
+   ARTK_CreateTask(Yielder, DEFAULT_STACK, HOG_PRIO) ;
+   ARTK_CreateTask(IsrWaiter, DEFAULT_STACK, 15) ;
+   ARTK_CreateTask(Hog, DEFAULT_STACK, HOG_PRIO) ;
+   ARTK_CreateTask(Hog, DEFAULT_STACK, HOG_PRIO) ;
+   ARTK_SetTimeSlice(HOG_PRIO, HOG_SLICE) ;
+   ARTK_CreateDeferWorker() ;
+   ARTK_CreateTask(Report, DEFAULT_STACK, MAX_PRIORITY) ;
+   // about every 0.7 ticks, so it drifts against the tick
+   HostAttachInterrupt(Irq, 11111) ;
+   HostAttachInterrupt(DeferIrq, 7919) ;
+}
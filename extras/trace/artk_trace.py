@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+# artk_trace.py - decodes the ARTK scheduler trace into a Chrome trace
+#
+# Build the sketch with ARTK_TRACE defined and run ARTK_TraceDrain as a
+# low priority task (see ARTK.h).  Then either capture the serial stream
+# to a file and decode it:
+#
+#    artk_trace.py capture.bin -o trace.json
+#
+# or read the port directly (needs pyserial):
+#
+#    artk_trace.py --port /dev/ttyACM0 --baud 115200 --seconds 10 -o trace.json
+#
+# Load trace.json in chrome://tracing or https://ui.perfetto.dev.  Each task
+# gets a row showing when it ran, with its sleeps, wakeups and blocking as
+# instant events.  Idle time and interrupt handlers marked with 
+# ARTK_TRACE_ISR get rows of their own.
+
+# This file is part of ARTK - Arduino Real-Time Kernel, and is distributed
+# under the terms of the GNU General Public License, version 3 or later.
+
+import argparse
+import json
+import struct
+import sys
+
+# must match kernel.h
+TRACE_START, TRACE_LOST, TRACE_SWITCH, TRACE_CREATE, TRACE_EXIT, \
+    TRACE_SLEEP, TRACE_WAKE, TRACE_BLOCK, TRACE_UNBLOCK, TRACE_IDLE, \
+    TRACE_IDLE_END, TRACE_TICK, TRACE_ISR, TRACE_ISR_END, TRACE_MARK = range(15)
+
+TRACE_SYNC = 0xA5
+RECORD = struct.Struct('<BBHH')     # type, arg, tick, phase
+
+INSTANTS = {
+    TRACE_CREATE: 'start',
+    TRACE_EXIT: 'exit',
+    TRACE_SLEEP: 'sleep',
+    TRACE_WAKE: 'wake',
+    TRACE_BLOCK: 'block',
+    TRACE_UNBLOCK: 'unblock',
+}
+
+IDLE_TID = 0
+ISR_TID = 1000
+PID = 1
+
+
+def records(data):
+    """Yields (type, arg, tick, phase), resynchronizing on the sync byte."""
+    i = 0
+    while i + 1 + RECORD.size <= len(data):
+        if data[i] != TRACE_SYNC:
+            i += 1
+            continue
+        rec = RECORD.unpack_from(data, i + 1)
+        if rec[0] > TRACE_MARK:
+            i += 1
+            continue
+        yield rec
+        i += 1 + RECORD.size
+
+
+class Decoder:
+    def __init__(self, show_ticks=False):
+        self.show_ticks = show_ticks
+        self.events = []
+        self.tick_us = None
+        self.counts = None
+        self.ticks = 0          # tick count with the 16 bit wraps restored
+        self.last_tick = None
+        self.running = None     # tid of the running task (or idle)
+        self.since = 0.0
+        self.before_idle = None
+        self.tasks = set()
+        self.isrs = set()
+        self.lost = 0
+
+    def time(self, tick, phase):
+        if self.last_tick is not None:
+            self.ticks += (tick - self.last_tick) & 0xFFFF
+        else:
+            self.ticks = tick
+        self.last_tick = tick
+        return self.ticks * self.tick_us + phase * self.tick_us / self.counts
+
+    def run(self, tid, ts):
+        # events can share a time stamp - that makes no slice
+        if self.running is not None and ts > self.since:
+            self.events.append({'name': self.name(self.running), 'ph': 'X',
+                                'pid': PID, 'tid': self.running,
+                                'ts': self.since, 'dur': ts - self.since})
+        self.running = tid
+        self.since = ts
+
+    def name(self, tid):
+        if tid == IDLE_TID:
+            return 'idle'
+        if tid >= ISR_TID:
+            return 'isr %d' % (tid - ISR_TID)
+        return 'task %d' % tid
+
+    def instant(self, name, tid, ts):
+        self.events.append({'name': name, 'ph': 'i', 's': 't',
+                            'pid': PID, 'tid': tid, 'ts': ts})
+
+    def feed(self, rec):
+        kind, arg, tick, phase = rec
+        if kind == TRACE_START:
+            self.tick_us, self.counts = tick, phase
+            return
+        if kind == TRACE_LOST:
+            self.lost += tick
+            return
+        # nothing can be timed until the first start record
+        if self.tick_us is None:
+            return
+        ts = self.time(tick, phase)
+
+        if kind == TRACE_SWITCH:
+            self.tasks.add(arg)
+            self.run(arg, ts)
+        elif kind == TRACE_IDLE:
+            self.before_idle = self.running
+            self.run(IDLE_TID, ts)
+        elif kind == TRACE_IDLE_END:
+            # the task that went idle carries on unless a switch follows
+            self.run(self.before_idle, ts)
+        elif kind in INSTANTS:
+            self.tasks.add(arg)
+            self.instant(INSTANTS[kind], arg, ts)
+        elif kind == TRACE_ISR or kind == TRACE_ISR_END:
+            self.isrs.add(arg)
+            self.events.append({'name': self.name(ISR_TID + arg),
+                                'ph': 'B' if kind == TRACE_ISR else 'E',
+                                'pid': PID, 'tid': ISR_TID + arg, 'ts': ts})
+        elif kind == TRACE_MARK:
+            tid = self.running if self.running is not None else IDLE_TID
+            self.instant('mark %d' % arg, tid, ts)
+        elif kind == TRACE_TICK and self.show_ticks:
+            self.instant('tick', IDLE_TID, ts)
+
+    def finish(self):
+        if self.running is not None and self.events:
+            end = max(e['ts'] for e in self.events)
+            self.run(None, end)
+        meta = [{'name': 'thread_name', 'ph': 'M', 'pid': PID, 'tid': IDLE_TID,
+                 'args': {'name': 'idle'}}]
+        for t in sorted(self.tasks):
+            meta.append({'name': 'thread_name', 'ph': 'M', 'pid': PID,
+                         'tid': t, 'args': {'name': self.name(t)}})
+        for n in sorted(self.isrs):
+            meta.append({'name': 'thread_name', 'ph': 'M', 'pid': PID,
+                         'tid': ISR_TID + n,
+                         'args': {'name': self.name(ISR_TID + n)}})
+        return {'traceEvents': meta + self.events,
+                'displayTimeUnit': 'ms',
+                'otherData': {'lost_events': self.lost}}
+
+
+def read_port(port, baud, seconds):
+    import time
+    import serial
+    data = bytearray()
+    with serial.Serial(port, baud, timeout=0.1) as s:
+        end = time.time() + seconds
+        while time.time() < end:
+            data += s.read(4096)
+    return bytes(data)
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Decode an ARTK scheduler trace')
+    ap.add_argument('capture', nargs='?', help='raw capture of the stream')
+    ap.add_argument('--port', help='serial port to read instead')
+    ap.add_argument('--baud', type=int, default=115200)
+    ap.add_argument('--seconds', type=float, default=10.0)
+    ap.add_argument('--ticks', action='store_true', help='show every tick')
+    ap.add_argument('-o', '--output', help='JSON file (default stdout)')
+    args = ap.parse_args()
+
+    if args.port:
+        data = read_port(args.port, args.baud, args.seconds)
+    elif args.capture:
+        with open(args.capture, 'rb') as f:
+            data = f.read()
+    else:
+        data = sys.stdin.buffer.read()
+
+    dec = Decoder(args.ticks)
+    for rec in records(data):
+        dec.feed(rec)
+    trace = dec.finish()
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    json.dump(trace, out)
+    if args.output:
+        out.close()
+    if dec.lost:
+        print('%d events were overwritten before they could be sent'
+              % dec.lost, file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -41,6 +41,12 @@ void ARTK_Sleep(unsigned int ticks)
 	Scheduler::InstancePtr->activeTask->task_sleep(ticks) ;
 }
 
+inline 
+char ARTK_SleepUntil(unsigned long *lastWake, unsigned int period)
+{
+	return Scheduler::InstancePtr->activeTask->task_sleepUntil(lastWake, period) ;
+}
+
 inline 
 void ARTK_Yield()
 {
@@ -36,22 +36,23 @@
 
 
 // Usage Notes:
-// ARTK makes use of the Arduino TimerOne library, which is distributed with it.
+// ARTK drives its tick from a Timer1 compare interrupt, so the TimerOne
+// library (or anything else that uses Timer1) can't be used alongside it.
 // You must NOT implement a setup() function
 // Implement a Setup() function instead - ARTK will call it for you
 // You must NOT implement a loop() function
 // Implement a Main() function instead, which will be the lowest priority task
 // See the file ARTKtest.ino for example usage 
-#include  <Arduino.h>    // for millis()
+#include  <Arduino.h>
 #include  <kernel.h>
 
 // -----------------------------------------------------------------
 // globals
 int glargeModel = FALSE ;
+int gidleMode = ARTK_IDLE_SLEEP ;
+unsigned long gtickInterval = DEFAULT_TICK ;
+void (*gstackHook)(Task *) = NULL ;
 unsigned char *glastSP = 0 ;
-Scheduler *Scheduler::InstancePtr = 0 ;
-DQNodeManager *DQNodeManager::instPtr = 0;
-TaskManager *TaskManager::instPtr = 0;
 
 //----------------------------------------------------------------
 // Doubly-linked list manipulation
@@ -65,6 +66,15 @@ void DNode::insertBefore(DNode *pLink)
 	pPrev = pLink ;
 }
 
+// also known as addFirst
+void DNode::insertAfter(DNode *pLink)
+{
+	pLink->pPrev = this ;
+	pLink->pNext = pNext ;
+	pNext->pPrev = pLink ;
+	pNext = pLink ;
+}
+
 // also known as removeFront
 DNode *DNode::removeNext()
 {
@@ -93,234 +103,589 @@ void DNode::remove()
 // The Sleep Queue is sorted singly linked list of DQNode (Delta Queue Node)
 // These are sorted in increasing order and keep track of the tick counts remaining
 // The counts remaining for a particular entry is the sum off all dcounts
-// up to and including that entry
+// up to and including that entry, with the head counting from sleepStamp
+// A node is either the one embedded in a task, or the one embedded in a
+// software timer, which has no pTask.
 
-DQNode DQNodeManager::DQList[MAX_THREAD_LIST];
+DQNode *pSleepHead = NULL ;
 
-void DQNodeManager::Instance() {
-	if (instPtr == NULL) {
-		instPtr = new DQNodeManager;
-	}
-}
+// tick count at which the head dcount was last brought up to date
+unsigned long sleepStamp = 0 ;
 
-DQNode *DQNodeManager::getFreeDQNode() {
-	unsigned char i;
-	for (i = 0; i < MAX_THREAD_LIST; i++) {
-		if (!DQList[i].inUse) {
-			DQList[i].inUse = !DQList[i].inUse;
-			DQList[i].start = millis();
-			return &DQList[i];
-		}
-	}
-	return NULL;
-}
+// Decrements the counter of the first node in the sleep queue by the ticks
+// elapsed since the last call.  The other nodes are relative to the head,
+// so the cost does not depend on the number of sleepers.
+void sleepDecrement()
+{
+   unsigned long current = Scheduler::InstancePtr->tickCount ;
 
-void DQNodeManager::releaseDQNode(DQNode *addr) {
-	unsigned char i;
-	for (i = 0; i < MAX_THREAD_LIST; i++) {
-		if (&DQList[i] == addr) {
-			DQList[i].inUse = FALSE;
-			DQList[i].pNext = 0;
-			DQList[i].pTask = 0;
-			DQList[i].dcount = 0;
-		}
-	}
+   if (pSleepHead != NULL)
+      pSleepHead->dcount -= (long)(current - sleepStamp) ;
+   sleepStamp = current ;
 }
 
-DQNode *pSleepHead = NULL ;
-
-// add a task to sleep q in sorted position
-void addSleeper(Task *pTask, unsigned int count)
+// add a node to sleep q in sorted position, due count ticks from now
+void insertSleeper(DQNode *pNew, long count)
 {
+   DQNode *pCurrent ;
+   DQNode *pOneBack ;
+   long   remaining = count ;
 
-   DQNode *pNew = DQNodeManager::instPtr->getFreeDQNode();
-   DQNode *pCurrent = NULL ;
-   DQNode *pOneBack = NULL ;
-
-   pNew->pTask = pTask ;
-   pNew->pNext = NULL ;
-   pNew->dcount = count ;
+   // the head must be current for the deltas to be relative to now
+   sleepDecrement() ;
 
-   if (pSleepHead == NULL)
-   {
-      pSleepHead = pNew ;
-   } 
-   else  
+   // find the position in increasing order
+   // at the same time, update the dcount of the new item by subtracting
+   // the count of all items that remain in front of it
+   // (equal wake times stay in FIFO order)
+   pCurrent = pSleepHead ;
+   pOneBack = NULL ;
+   while ( (pCurrent != NULL) && (pCurrent->dcount <= remaining) )
    {
-      // find the position in increasing order
-      // at the same time, update the dcount of the new item by subtracting
-      // the count of all items that remain in front of it
-      pCurrent = pSleepHead ;
-      pOneBack = NULL ;
-      while ( (pCurrent != NULL) && (pCurrent->dcount < pNew->dcount) )
-      {
-         pOneBack = pCurrent ;
-         pCurrent = pCurrent->pNext ;
-      }
-      // now insert the new item 
-      // if our new count is the smallest in the list, put it at the head
-      if (pOneBack == NULL)   
-      {
-         // decrement the current head count by the new count
-		 pSleepHead = pNew ;
-		 pNew->pNext = pCurrent ;
-      } 
-      // else if our new count is the largest, put it at the tail
-      else if (pCurrent == NULL) 
-      {
-	     pOneBack->pNext = pNew ;
-	  } 
-	  // else we're going in the middle somewhere
-      else 
-      {
-         // decrement the follower count by the new count
-         pOneBack->pNext = pNew ;
-         pNew->pNext = pCurrent ;
-	  }
+      remaining -= pCurrent->dcount ;
+      pOneBack = pCurrent ;
+      pCurrent = pCurrent->pNext ;
    }
+   pNew->dcount = remaining ;
+   pNew->pNext = pCurrent ;
+
+   // if our new count is the smallest in the list, put it at the head
+   if (pOneBack == NULL)
+      pSleepHead = pNew ;
+   else
+      pOneBack->pNext = pNew ;
+
+   // decrement the follower count by the new count
+   if (pCurrent != NULL)
+      pCurrent->dcount -= remaining ;
+}
+
+// add a task to sleep q in sorted position
+void addSleeper(Task *pTask, unsigned int count)
+{
+   insertSleeper(&pTask->sleepNode, count) ;
 }
 
-// If the count of the first task on the sleep queue is 0 then remove it
-Task *removeWaker()
+// If the count of the first node on the sleep queue is 0 then remove it
+// The node keeps its dcount, which is 0 or how many ticks it is overdue
+// (negated)
+DQNode *removeWaker()
 {
-   Task *pTask ;
    DQNode *pTemp ;
 
-   pTask = NULL ;
+   pTemp = NULL ;
    if ( (pSleepHead != NULL) && (pSleepHead->dcount <= 0) )
    {
       pTemp = pSleepHead ;
       pSleepHead = pTemp->pNext ;
-	  pTask = pTemp->pTask ;
-	  DQNodeManager::instPtr->releaseDQNode(pTemp);
+      // if the head overshot, the follower is due that much sooner
+      if (pSleepHead != NULL)
+         pSleepHead->dcount += pTemp->dcount ;
    }
-   return pTask ;
+   return pTemp ;
 }
 
-// Decrements the counter of the first node in the sleep queue
-void sleepDecrement()
+// take pCurrent, which follows pOneBack (NULL at the head), off the queue
+void unlinkSleeper(DQNode *pOneBack, DQNode *pCurrent)
 {
-   unsigned long current;
-   DQNode *tmp = pSleepHead;
-   if (pSleepHead != NULL) {
-	   current = millis();
-	   pSleepHead->dcount-= current-pSleepHead->start ;
-	   pSleepHead->start = current;
-	   while (tmp->pNext != NULL) {
-		   tmp = tmp->pNext;
-		   tmp->dcount -= current-tmp->start ;
-		   tmp->start = current;
-	   }
-   }
+   DQNode *pNext ;
+
+   pNext = pCurrent->pNext ;
+   // if found was first entry, adjust head pointer
+   if (pOneBack == NULL) 
+      pSleepHead = pNext ;
+   // else adjust the one position back next pointer
+   else
+      pOneBack->pNext = pNext ;
+
+   // adjust the delta of the following entry up
+   if (pNext != NULL)
+      pNext->dcount += pCurrent->dcount ;
 }
 
-// search for a task and remove it from the sleep queue
-void removeSleeper(Task *pTask)
+// search for a node and remove it from the sleep queue
+void removeSleepNode(DQNode *pNode)
 {
-   int    done ;
    DQNode *pOneBack ;
-   DQNode *pNext ;
    DQNode *pCurrent ;
 
    pCurrent = pSleepHead ;
    pOneBack = NULL ;
-   done = (pCurrent == NULL) ;
-   while (!done) 
+   while ( (pCurrent != NULL) && (pCurrent != pNode) )
    {
-      // if we found the task
-      if (pCurrent->pTask == pTask) 
-      {
-         done = TRUE ;
-         // if found was first entry, adjust head pointer
-         if (pOneBack == NULL) 
-            pSleepHead = pCurrent->pNext ;
-         // else adjust the one position back next pointer
-         else
-		    pOneBack->pNext = pCurrent->pNext ;
-         
-         // adjust the delta of the following entry up
-         pNext = pCurrent->pNext ;
-         DQNodeManager::instPtr->releaseDQNode(pCurrent);
-      } 
-      else 
-      {
-         pOneBack = pCurrent ;
-         pCurrent = pCurrent->pNext ;
-         done = (pCurrent == NULL) ;
-      }
+      pOneBack = pCurrent ;
+      pCurrent = pCurrent->pNext ;
+   }
+   if (pCurrent != NULL)
+      unlinkSleeper(pOneBack, pCurrent) ;
+}
+
+void removeSleeper(Task *pTask)
+{
+   removeSleepNode(&pTask->sleepNode) ;
+}
+
+//-------------------------------------------------------------
+// Trace
+//
+
+#ifdef ARTK_TRACE
+static TraceEvent traceRing[TRACE_SIZE] ;
+static unsigned char traceHead = 0 ;
+static unsigned char traceTail = 0 ;
+static unsigned int traceLost = 0 ;
+unsigned char gtraceIds = 0 ;
+
+void traceEvent(unsigned char type, unsigned char arg)
+{
+	unsigned char sreg = SREG ;
+	unsigned long ticks ;
+	TraceEvent *ev ;
+
+	cli() ;
+	ev = &traceRing[traceHead] ;
+	ev->type = type ;
+	ev->arg = arg ;
+	ticks = Scheduler::InstancePtr->tickCount ;
+	ev->phase = (uint16_t)TickStamp(&ticks) ;
+	ev->tick = (uint16_t)ticks ;
+	if (++traceHead == TRACE_SIZE)
+		traceHead = 0 ;
+	// full - the oldest goes
+	if (traceHead == traceTail)
+	{
+		if (++traceTail == TRACE_SIZE)
+			traceTail = 0 ;
+		traceLost++ ;
+	}
+	SREG = sreg ;
+}
+
+// copies out the oldest event, FALSE if there is none
+static char traceRead(TraceEvent *ev)
+{
+	cli() ;
+	if (traceHead == traceTail)
+	{
+		sei() ;
+		return FALSE ;
+	}
+	*ev = traceRing[traceTail] ;
+	if (++traceTail == TRACE_SIZE)
+		traceTail = 0 ;
+	sei() ;
+	return TRUE ;
+}
+
+// each record goes out as a sync byte, the type, the argument, then the
+// tick and the phase little endian - 7 bytes whatever the struct's layout
+#define TRACE_SYNC  0xA5
+
+static void traceSend(TraceEvent *ev)
+{
+	uint8_t rec[7] ;
+
+	rec[0] = TRACE_SYNC ;
+	rec[1] = ev->type ;
+	rec[2] = ev->arg ;
+	rec[3] = (uint8_t)ev->tick ;
+	rec[4] = (uint8_t)(ev->tick >> 8) ;
+	rec[5] = (uint8_t)ev->phase ;
+	rec[6] = (uint8_t)(ev->phase >> 8) ;
+	Serial.write(rec, sizeof(rec)) ;
+}
+
+// The drain task.  Every batch starts with a TRACE_START record giving
+// the time base, so a decoder can pick the stream up at any point.
+void ARTK_TraceDrain()
+{
+	TraceEvent ev ;
+	unsigned int lost ;
+
+	for (;;)
+	{
+		ev.type = TRACE_START ;
+		ev.arg = 0 ;
+		ev.tick = (uint16_t)gtickInterval ;
+		ev.phase = (uint16_t)(TickCycles(1, 0) / TickCycles(0, 1)) ;
+		traceSend(&ev) ;
+
+		cli() ;
+		lost = traceLost ;
+		traceLost = 0 ;
+		sei() ;
+		if (lost > 0)
+		{
+			ev.type = TRACE_LOST ;
+			ev.tick = lost ;
+			ev.phase = 0 ;
+			traceSend(&ev) ;
+		}
+
+		while (traceRead(&ev))
+			traceSend(&ev) ;
+		ARTK_Sleep(TRACE_DRAIN_TICKS) ;
+	}
+}
+#endif
+
+//-------------------------------------------------------------
+// Run time statistics
+//
+
+#ifdef ARTK_STATS
+TaskStats *Scheduler::statsOf(Task *t)
+{
+	if (t == NULL)
+		return &idleStats ;
+	if (t->statsEpoch != statsEpoch)
+	{
+		t->stats.runCycles = 0 ;
+		t->stats.switches = 0 ;
+		t->stats.preemptions = 0 ;
+		t->statsEpoch = statsEpoch ;
 	}
+	return &t->stats ;
+}
+
+// called with interrupts disabled
+void Scheduler::account()
+{
+	unsigned long now = CycleCount(tickCount) ;
+
+	statsOf(idling ? NULL : activeTask)->runCycles += now - statsStamp ;
+	statsStamp = now ;
+}
+
+void Scheduler::resetStats()
+{
+	unsigned char sreg = SREG ;
+
+	cli() ;
+	account() ;
+	statsEpoch++ ;
+	idleStats.runCycles = 0 ;
+	idleStats.switches = 0 ;
+	idleStats.preemptions = 0 ;
+	windowStart = statsStamp ;
+	SREG = sreg ;
 }
+#endif
 
 //-------------------------------------------------------------
 // Scheduler
 //
 
+// The kernel objects are all statically allocated, so they show up in the
+// data size at build time and nothing comes from the heap.  Their pointers
+// are constants, and the objects are constructed before setup() runs.
+Scheduler Scheduler::instance ;
+Scheduler *Scheduler::InstancePtr = &Scheduler::instance ;
+
 Scheduler::Scheduler()
 {
 	numTasks = 0 ;
+	readyMask = 0 ;
 	activeTask = NULL ;
+	tickCount = 0 ;
+	idling = FALSE ;
+	inTick = FALSE ;
+	memset(timeSlice, 0, sizeof(timeSlice)) ;
+	idleEntries = 0 ;
+	sleptCycles = 0 ;
+#ifdef ARTK_STATS
+	idleStats.runCycles = 0 ;
+	idleStats.switches = 0 ;
+	idleStats.preemptions = 0 ;
+	statsEpoch = 0 ;
+	statsStamp = 0 ;
+	windowStart = 0 ;
+#endif
+}
+
+// most significant set bit of a nibble (the value for 0 is never used)
+static const unsigned char nibbleTop[16] PROGMEM =
+	{ 0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3 } ;
+
+// constant time search of the ready bitmap
+unsigned char Scheduler::topReady()
+{
+	unsigned char bits = (unsigned char)(readyMask >> 8) ;
+	unsigned char base = 8 ;
+
+	if (bits == 0)
+	{
+		bits = (unsigned char)readyMask ;
+		base = 0 ;
+	}
+	if (bits & 0xF0)
+	{
+		bits >>= 4 ;
+		base += 4 ;
+	}
+	return base + pgm_read_byte(&nibbleTop[bits]) ;
+}
+
+// a task going to the back of its list starts a new time slice
+void Scheduler::addready(Task *t)
+{
+	t->sliceUsed = 0 ;
+#ifdef ARTK_EDF
+	if (t->relDeadline != 0)
+	{
+		insertReady(t, FALSE) ;
+		return ;
+	}
+#endif
+	readyList[t->priority-1].addLast(&t->mylink) ;
+	readyMask |= (1U << (t->priority-1)) ;
+}
+
+// a preempted task goes back to the front of its list so that it 
+// resumes before its peers
+void Scheduler::addreadyFirst(Task *t)
+{
+#ifdef ARTK_EDF
+	insertReady(t, TRUE) ;
+#else
+	readyList[t->priority-1].addFirst(&t->mylink) ;
+	readyMask |= (1U << (t->priority-1)) ;
+#endif
+}
+
+#ifdef ARTK_EDF
+// Earliest deadline first
+// Tasks with a deadline go ahead of those without, in deadline order, so
+// among the ready tasks of one priority the earliest deadline runs.  A
+// higher priority still wins outright, whatever the deadlines.  Inserting
+// walks the list, so it costs a little for each ready peer.
+char Scheduler::earlier(Task *a, Task *b)
+{
+	return a->relDeadline != 0 &&
+	       (b->relDeadline == 0 || (long)(a->deadline - b->deadline) < 0) ;
+}
+
+void Scheduler::insertReady(Task *t, char first)
+{
+	DNode *list = &readyList[t->priority-1] ;
+	DNode *pLink = list->next() ;
+
+	if (first)
+		while (pLink != list && earlier((Task *)pLink, t))
+			pLink = pLink->next() ;
+	else
+		while (pLink != list && !earlier(t, (Task *)pLink))
+			pLink = pLink->next() ;
+	pLink->insertBefore(&t->mylink) ;
+	readyMask |= (1U << (t->priority-1)) ;
+}
+
+// A job is late if it ends after the tick its deadline falls in
+void Scheduler::jobDone()
+{
+	if (activeTask->relDeadline != 0 && 
+	    (long)(tickCount - activeTask->deadline) > 0)
+		activeTask->misses++ ;
+}
+
+void Scheduler::setDeadline(Task *t, unsigned int ticks)
+{
+	unsigned char sreg = SREG ;
+
+	cli() ;
+	t->relDeadline = ticks ;
+	release(t) ;
+	if (t->parameter.state == TASK_READY)
+	{
+		removeready(t) ;
+		addready(t) ;
+	}
+	if (activeTask != NULL)
+		preempt() ;
+	SREG = sreg ;
+}
+
+unsigned int Scheduler::takeMisses(Task *t)
+{
+	unsigned int misses ;
+
+	cli() ;
+	misses = t->misses ;
+	t->misses = 0 ;
+	sei() ;
+	return misses ;
+}
+#endif
+
+void Scheduler::removeready(Task *t)
+{
+	t->mylink.remove() ;
+	if (readyList[t->priority-1].isEmpty())
+		readyMask &= ~(1U << (t->priority-1)) ;
 }
 
 // called when a new task is created
 char Scheduler::addNewTask(Task *t)
 {
+	unsigned char sreg = SREG ;
+
+	cli() ;
 	numTasks++ ;
 	t->makeTaskReady() ;
+#ifdef ARTK_EDF
+	release(t) ;
+#endif
 	addready(t) ;
+	SREG = sreg ;
 	return(TRUE) ;
 }
 
-// reduce the count of active tasks by one
-void Scheduler::removeTask()
+// ends a task, reducing the count of tasks by one
+// The active task ending itself never returns.  Its stack is already back 
+// in the arena, but nothing can allocate it until it is switched away 
+// from, and with no active task resched() restores the next task without
+// saving anything.
+void Scheduler::removeTask(Task *t)
 {
-	numTasks-- ;
-	if (numTasks == 1) // all but idle have terminated
+	unsigned char sreg = SREG ;
+
+	cli() ;
+	if (!t->parameter.inUse)
+	{
+		SREG = sreg ;
+		return ;
+	}
+	reclaim(t) ;
+	if (numTasks == 0) // all tasks have terminated
 		ARTK_TerminateMultitasking() ;
-	else 
-       resched() ;
+
+	if (t == activeTask)
+	{
+#ifdef ARTK_STATS
+		account() ;
+#endif
+		activeTask = NULL ;
+		resched() ;
+	}
+	// its joiners or the waiters for its mutexes may outrank us
+	if (activeTask != NULL)
+		preempt() ;
+	SREG = sreg ;
+}
+
+void Scheduler::reclaim(Task *t)
+{
+	Mutex *m ;
+
+	TRACE(TRACE_EXIT, t->traceId) ;
+	switch (t->parameter.state)
+	{
+	case TASK_READY:
+		removeready(t) ;
+		break ;
+	case TASK_BLOCKED:
+		t->mylink.remove() ;
+		if (t->parameter.timed)
+			removeSleeper(t) ;
+		// the owner may have been running at our priority, and so may
+		// the owners down the chain from it
+		m = t->pWaitMutex ;
+		if (m != NULL)
+			updatePriority(m->owner) ;
+		break ;
+	case SLEEP_BLOCKED:
+		removeSleeper(t) ;
+		break ;
+	}
+
+	while (t->pHeld != NULL)
+		t->pHeld->handOver() ;
+	while (unblock(&t->joinList) != NULL)
+		;
+
+	numTasks-- ;
+	if (t->parameter.isStatic)
+		t->parameter.inUse = FALSE ;
+	else
+	{
+		StackManager::instPtr->releaseStack(t->stack, t->stackSize) ;
+		TaskManager::releaseTask(t) ;
+	}
+}
+
+char Scheduler::join(Task *t, unsigned int timeout)
+{
+	cli() ;
+	if (!t->parameter.inUse || t == activeTask)
+	{
+		sei() ;
+		return (t != activeTask) ;
+	}
+	return blockTimeout(&t->joinList, timeout) ;
 }
 
 //  Selects the next task and performs a context switch
+//  Must be called with interrupts disabled - returns with them enabled
 void Scheduler::resched()
 {
 	Task   *oldTask ;
 	Task   *newTask ;
 
-    // remove highest priority task from readyList
-	if (!readyList.isEmpty())
-    {
-		newTask = (Task *)readyList.removeFront() ;
-	}
-	else {
-		while (!this->timerISR());
-		newTask = (Task *)readyList.removeFront() ;
-	}
+	unsigned char top ;
+
+#ifdef ARTK_EDF
+	if (activeTask != NULL && activeTask->parameter.state >= TASK_BLOCKED)
+		jobDone() ;
+#endif
+
+    // wait for something to become ready
+	if (readyMask == 0)
+		idle() ;
+
+    // remove highest priority task from its readyList
+	top = topReady() ;
+	newTask = (Task *)readyList[top].removeFront() ;
+	if (readyList[top].isEmpty())
+		readyMask &= ~(1U << top) ;
 
 	// If calling task is still the highest priority just return
 	if (newTask == activeTask) 
     {
 		activeTask->makeTaskActive() ;
+		// the tick returns with a reti
+		if (!inTick)
+			sei() ;
 		return ;
 	}
 
 	oldTask = activeTask ;
+#ifdef ARTK_STATS
+	account() ;
+	statsOf(newTask)->switches++ ;
+#endif
 	activeTask = newTask ;
 	activeTask->makeTaskActive() ;
+	TRACE(TRACE_SWITCH, activeTask->traceId) ;
+
+	// there must be room for the cooperative frame of the outgoing task
+	// (the tick checks the full frame it has already pushed)
+	if (oldTask != NULL && !inTick)
+		checkStack(oldTask, StackPointer() - COOP_FRAME_SIZE) ;
 	
-	// a context switch is necessary - clear interrupts while we do this
-	// interrupts are reenabled when the new task is swapped in
-    cli() ;
-	
+	// a context switch is necessary - interrupts are still clear and
+	// are reenabled when the new task is swapped in
+	// the tick interrupt swaps stacks itself
+	if (inTick)
+		return ;
+
 	// swap the new task in
-	// if it is the first run, then use processor state from current task
-	// otherwise get processor state from the stack of its previous swap out
+	// get processor state from the stack of its previous swap out, which
+	// carries its own frame marker (see machine.cpp)
 	// if the oldTask is NULL then this is the first time we've ever done
 	// a task switch, and we don't try to save the context (IOW, the stack
 	// state of main() is abandoned on the first task switch)
-	int firstRun = activeTask->parameter.firstRun ;
-	activeTask->parameter.firstRun = FALSE ;
 	if (oldTask != NULL) {
-		ContextSwitch(&oldTask->pStack, activeTask->pStack, firstRun) ;
+		ContextSwitch(&oldTask->pStack, activeTask->pStack) ;
 	}
 
     else {
@@ -328,153 +693,1624 @@ void Scheduler::resched()
     }
 }
 
+//  Called from resched() when nothing is ready to run.
+//  Rather than taking a tick every period, the tick is stretched to expire
+//  when the earliest sleeper is due and the processor sleeps until then.
+//  Wakeups by unrelated interrupts (e.g. the millis() overflow) go straight
+//  back to sleep without touching the sleep queue.  If another interrupt 
+//  makes a task ready first, the whole ticks that elapsed are credited.
+//  With nothing on the sleep queue only an external interrupt can make a 
+//  task ready, so power-down is used if ARTK_IDLE_DEEP allows it.
+//  Called and returns with interrupts disabled.
+void Scheduler::idle()
+{
+	unsigned long start = CycleCount(tickCount) ;
+	char deep ;
+
+#ifdef ARTK_STATS
+	account() ;
+	idleStats.switches++ ;
+#endif
+	idling = TRUE ;
+	idleEntries++ ;
+	TRACE(TRACE_IDLE, 0) ;
+	while (readyMask == 0)
+	{
+		deep = (pSleepHead == NULL) && (gidleMode == ARTK_IDLE_DEEP) ;
+		if (pSleepHead == NULL)
+			TickStretch(0) ;
+		else if (pSleepHead->dcount > 1)
+			TickStretch(pSleepHead->dcount) ;
+		IdleSleep(deep) ;
+	}
+	tick(TickResume()) ;
+#ifdef ARTK_STATS
+	account() ;
+#endif
+	idling = FALSE ;
+	TRACE(TRACE_IDLE_END, 0) ;
+
+	sleptCycles += CycleCount(tickCount) - start ;
+}
+
 //  Called by a task when it is ready to yield
 void Scheduler::relinquish()
 {
-	timerISR();
+	cli() ;
 	activeTask->makeTaskReady() ;
 	addready(activeTask) ;
 	resched() ;
 }
 
-// Creates an instance of the scheduler only if none exists
-void Scheduler::Instance()
+//  Called from the tick interrupt with the number of ticks since the last 
+//  call - more than one when the tick was stretched while idle.
+//  Wakes due sleepers, rotates the active task behind its peers if its 
+//  time slice is up, and preempts it if one of the sleepers (or a task 
+//  readied by some other interrupt) outranks it.  From the tick 
+//  interrupt, resched() only selects the new task and tickSwitch() hands
+//  its stack back to the interrupt to be restored.
+void Scheduler::tick(unsigned int ticks)
 {
-    if (InstancePtr == 0)
-       InstancePtr = new Scheduler() ;
+	if (ticks == 0)
+		return ;
+	tickCount += ticks ;
+#ifdef ARTK_STATS
+	// keeps the charges well short of the cycle count wrapping
+	if (!idling)
+		account() ;
+#endif
+	TRACE(TRACE_TICK, (unsigned char)ticks) ;
+	timerISR() ;
+	if (!idling && activeTask != NULL)
+	{
+		slice(ticks) ;
+		preempt() ;
+	}
 }
 
-void Scheduler::startMultiTasking()
+//  Round robin among tasks of equal priority, for the levels given a 
+//  quantum with ARTK_SetTimeSlice.  The slice is restarted by addready(), 
+//  so a preempted task (which goes back to the front of its list) keeps 
+//  what is left of it.  A task that runs out its slice with nothing else 
+//  ready at its level just starts another one.
+void Scheduler::slice(unsigned int ticks)
 {
-    // get Idle and Main tasks going
-    resched() ;   
-}
+	unsigned char quantum = timeSlice[activeTask->priority-1] ;
 
-Task::Task() {
-	parameter.firstRun = TRUE ;
-	parameter.inUse = FALSE;
-	pStack = &stack[MIN_STACK-1] ;
+	if (quantum == 0)
+		return ;
+	if (activeTask->sliceUsed + ticks < quantum)
+	{
+		activeTask->sliceUsed += ticks ;
+		return ;
+	}
+	activeTask->sliceUsed = 0 ;
+	if (readyList[activeTask->priority-1].isEmpty())
+		return ;
+	activeTask->makeTaskReady() ;
+	addready(activeTask) ;
+#ifdef ARTK_STATS
+	// under ARTK_EDF it goes back in deadline order, and may still be first
+	if ((Task *)readyList[topReady()].next() != activeTask)
+		statsOf(activeTask)->preemptions++ ;
+#endif
+	resched() ;
 }
 
-//  When the root function for a task returns, it executes
-//  this function.
-void Task::taskDone()
+//  Called when a task of higher priority than the active task may have
+//  become ready.  Must be called with interrupts disabled.
+void Scheduler::preempt()
 {
-   // added this call
-   Scheduler::InstancePtr->removeready(Scheduler::InstancePtr->activeTask) ;
-   Scheduler::InstancePtr->removeTask();
+	unsigned char top ;
+
+	if (readyMask == 0)
+		return ;
+	top = topReady() ;
+	if (top < activeTask->priority)
+	{
+#ifdef ARTK_EDF
+		// a peer with an earlier deadline preempts too
+		if (top + 1 != activeTask->priority ||
+		    !earlier((Task *)readyList[top].next(), activeTask))
+#endif
+			return ;
+	}
+#ifdef ARTK_STATS
+	statsOf(activeTask)->preemptions++ ;
+#endif
+	activeTask->makeTaskReady() ;
+	addreadyFirst(activeTask) ;
+	resched() ;
 }
 
-// the calling task is put to sleep for cnt ticks of the system timer
-void Task::task_sleep(unsigned int cnt)
+char Scheduler::outranks(Task *t)
 {
-	if (cnt > 0)
-    {
-		makeTaskSleepBlocked() ;
-		addSleeper(this, cnt) ;
-		Scheduler::InstancePtr->resched() ;
-	}
+	if (activeTask == NULL || t->priority > activeTask->priority)
+		return TRUE ;
+#ifdef ARTK_EDF
+	return t->priority == activeTask->priority && earlier(t, activeTask) ;
+#else
+	return FALSE ;
+#endif
 }
 
-void Task::PushScheduler() {
-	// next put the entry function on the stack so we return to it after
-	// returning from a context switch
-	*pStack-- = (unsigned char)((long)rootFn & 0x00ff) ;
-	*pStack-- = (unsigned char)(((long)rootFn >> 8) & 0x00ff) ;
-	if (glargeModel)
-	   *pStack-- = (unsigned char)(((long)rootFn >> 16) & 0x00ff) ;
-	Scheduler::InstancePtr->addNewTask(this) ;
+//  An interrupt handler may not switch while the tick runs or while idle()
+//  sleeps inside resched() - idle() picks up whatever became ready
+void Scheduler::preemptFromISR()
+{
+	if (!idling && !inTick && activeTask != NULL)
+		preempt() ;
 }
 
-Task TaskManager::listTask[MAX_THREAD_LIST];
+void Scheduler::addWaiter(DNode *waitList, Task *t)
+{
+	DNode *pLink = waitList->next() ;
 
-void TaskManager::Instance() {
-	if (instPtr == NULL) {
-		instPtr = new TaskManager;
-	}
+	while (pLink != waitList && ((Task *)pLink)->priority >= t->priority)
+		pLink = pLink->next() ;
+	pLink->insertBefore(&t->mylink) ;
 }
 
-Task* TaskManager::getFreeTask() {
-	unsigned char i;
-	for (i = 0; i < MAX_THREAD_LIST; i++) {
-		if (!listTask[i].parameter.inUse) {
-			listTask[i].parameter.inUse = !listTask[i].parameter.inUse;
-			return &listTask[i];
-		}
+void Scheduler::changePriority(Task *t, unsigned char prio)
+{
+	if (t->priority == prio)
+		return ;
+	if (t->parameter.state == TASK_READY)
+	{
+		removeready(t) ;
+		t->priority = prio ;
+		addready(t) ;
 	}
-	return NULL;
-}
-
-void TaskManager::releaseTask(Task *addr) {
-	unsigned char i;
-	for (i = 0; i < MAX_THREAD_LIST; i++) {
-		if (&listTask[i] == addr) {
-			listTask[i].parameter.inUse = FALSE;
-		}
+	else if (t->parameter.state == TASK_BLOCKED && t->pWaitList != NULL)
+	{
+		t->mylink.remove() ;
+		t->priority = prio ;
+		addWaiter(t->pWaitList, t) ;
 	}
+	else
+		t->priority = prio ;
 }
 
-char Scheduler::timerISR()
+void Scheduler::inherit(Task *t)
 {
-	char taskReady = FALSE;
-	Task *pWakeup ;
-	// Check for waiting tasks that have timed out and 
-    // sleeping tasks that must be woken
-	// decrement the count of the head of the sleepq
-	sleepDecrement() ;
-	
-	// get all those off the sleep q that are at 0
-	pWakeup = removeWaker() ;
-	while (pWakeup != NULL)
-	{
-        // either way (semaphore or just sleeping), it goes to ready list
-        pWakeup->makeTaskReady() ;
-		Scheduler::InstancePtr->addready(pWakeup) ;
+	Task *owner ;
 
-        // see if anymore are at 0
-		pWakeup = removeWaker() ;
-		taskReady = TRUE;
+	while (t->pWaitMutex != NULL)
+	{
+		owner = t->pWaitMutex->owner ;
+		if (owner->priority >= t->priority)
+			break ;
+		changePriority(owner, t->priority) ;
+		t = owner ;
 	}
-	return taskReady;
 }
 
-//--------------------------------------------------------------------------
-// User-accessible constructs
-
-Task *ARTK_CreateTask(void (*rootFnPtr)(), unsigned stacksize)
+void Scheduler::updatePriority(Task *t)
 {
-   Task *task = TaskManager::instPtr->getFreeTask();
-   task->setFunction(rootFnPtr);
-   task->PushScheduler();
-   return task ;
+	unsigned char prio ;
+
+	while (t != NULL)
+	{
+		prio = t->inheritedPriority() ;
+		if (prio == t->priority)
+			break ;
+		changePriority(t, prio) ;
+		t = (t->pWaitMutex != NULL) ? t->pWaitMutex->owner : NULL ;
+	}
 }
 
-void ARTK_TerminateMultitasking()
+// waitList may be NULL for a task that some other task or interrupt 
+// handler will ready by name (see Task::notify)
+void Scheduler::block(DNode *waitList)
 {
-   exit(0) ;
+	activeTask->pWaitList = waitList ;
+	if (waitList != NULL)
+		addWaiter(waitList, activeTask) ;
+	activeTask->makeTaskBlocked() ;
+	TRACE(TRACE_BLOCK, activeTask->traceId) ;
+	resched() ;
 }
 
-void ARTK_SetOptions(int iLargeModel)
+char Scheduler::blockTimeout(DNode *waitList, unsigned int timeout)
+{
+	Task *self = activeTask ;
+
+	self->parameter.timedOut = FALSE ;
+	if (timeout > 0)
+	{
+		self->parameter.timed = TRUE ;
+		addSleeper(self, timeout) ;
+	}
+	block(waitList) ;
+	return !self->parameter.timedOut ;
+}
+
+Task *Scheduler::unblock(DNode *waitList)
+{
+	Task *t ;
+
+	if (waitList->isEmpty())
+		return NULL ;
+	t = (Task *)waitList->next() ;
+	unblockTask(t) ;
+	return t ;
+}
+
+void Scheduler::unblockTask(Task *t)
+{
+	t->mylink.remove() ;
+	if (t->parameter.timed)
+	{
+		removeSleeper(t) ;
+		t->parameter.timed = FALSE ;
+	}
+	TRACE(TRACE_UNBLOCK, t->traceId) ;
+	t->makeTaskReady() ;
+#ifdef ARTK_EDF
+	release(t) ;
+#endif
+	addready(t) ;
+}
+
+// a blocked task woken by the sleep queue has timed out, and comes off
+// the list it was waiting on
+void Scheduler::wakeup(Task *t)
+{
+	if (t->parameter.state == TASK_BLOCKED)
+	{
+		t->mylink.remove() ;
+		t->parameter.timed = FALSE ;
+		t->parameter.timedOut = TRUE ;
+		t->parameter.notifyWait = FALSE ;
+	}
+	TRACE(TRACE_WAKE, t->traceId) ;
+	t->makeTaskReady() ;
+#ifdef ARTK_EDF
+	release(t) ;
+#endif
+	addready(t) ;
+}
+
+void Scheduler::setPriority(Task *t, unsigned char prio)
+{
+	unsigned char sreg = SREG ;
+
+	cli() ;
+	t->basePriority = prio ;
+	// up or down, the owners it waits on follow
+	updatePriority(t) ;
+
+	// the active task may have lowered itself below a ready task
+	if (activeTask != NULL)
+		preempt() ;
+	SREG = sreg ;
+}
+
+unsigned int Scheduler::stackLeft()
+{
+	return StackPointer() - activeTask->stack ;
+}
+
+void Scheduler::checkStack(Task *t, unsigned char *sp)
+{
+	if ((sp < t->stack || t->stack[0] != STACK_PAINT) && gstackHook != NULL)
+		gstackHook(t) ;
+}
+
+
+void Scheduler::startMultiTasking()
+{
+    // get the tick going, then the first task
+    cli() ;
+    TickStart(gtickInterval) ;
+    resched() ;   
+}
+
+// the tick interrupt calls in here (see machine.cpp)
+// if the tick preempts, the full frame at sp becomes the saved context of
+// the interrupted task and the interrupt returns into the new one
+unsigned char *Scheduler::tickSwitch(unsigned char *sp, unsigned int ticks)
+{
+    Task *interrupted = activeTask ;
+
+    inTick = TRUE ;
+    tick(ticks) ;
+    inTick = FALSE ;
+
+    if (activeTask == interrupted)
+       return sp ;
+    checkStack(interrupted, sp) ;
+    interrupted->pStack = sp ;
+    return activeTask->pStack ;
+}
+
+unsigned char *KernelTick(unsigned char *sp, unsigned int ticks)
+{
+    return Scheduler::InstancePtr->tickSwitch(sp, ticks) ;
+}
+
+static unsigned char clampPriority(unsigned priority)
+{
+   if (priority < MIN_PRIORITY)
+      return MIN_PRIORITY ;
+   if (priority > MAX_PRIORITY)
+      return MAX_PRIORITY ;
+   return (unsigned char)priority ;
+}
+
+Task::Task() {
+	parameter.inUse = FALSE;
+	parameter.isStatic = FALSE;
+	init() ;
+}
+
+// tasks declared with ARTK_TASK, linked through their sleep nodes until 
+// setup() starts them
+DQNode *gstaticTasks = NULL ;
+
+// A task declared with ARTK_TASK is constructed before setup() runs, 
+// possibly before the kernel objects, so this only fills in the task and
+// puts it on gstaticTasks, which is initialized before any constructor
+Task::Task(void (*rootFnPtr)(), unsigned prio, unsigned char *base, 
+           unsigned int size) {
+	parameter.inUse = TRUE;
+	parameter.isStatic = TRUE;
+	init() ;
+	setFunction(rootFnPtr) ;
+	setPriority(clampPriority(prio)) ;
+	stack = base ;
+	stackSize = size ;
+	sleepNode.pNext = gstaticTasks ;
+	gstaticTasks = &sleepNode ;
+}
+
+void Task::init() {
+	parameter.state = 0 ;
+	parameter.timed = FALSE ;
+	parameter.timedOut = FALSE ;
+	parameter.notifyWait = FALSE ;
+	priority = basePriority = MIN_PRIORITY ;
+	pWaitList = NULL ;
+	pHeld = NULL ;
+	pWaitMutex = NULL ;
+	waitBits = 0 ;
+	waitMode = 0 ;
+	notifyBits = 0 ;
+	sliceUsed = 0 ;
+#ifdef ARTK_EDF
+	relDeadline = 0 ;
+	deadline = 0 ;
+	misses = 0 ;
+#endif
+#ifdef ARTK_STATS
+	// a reused slot starts with none of its last task's stats
+	stats.runCycles = 0 ;
+	stats.switches = 0 ;
+	stats.preemptions = 0 ;
+	statsEpoch = Scheduler::InstancePtr->statsEpoch ;
+#endif
+	sleepNode.pTask = this ;
+	sleepNode.pNext = NULL ;
+	stack = NULL ;
+	stackSize = 0 ;
+	pStack = NULL ;
+}
+
+void Task::setStack(unsigned char *base, unsigned int size)
+{
+	stack = base ;
+	stackSize = size ;
+	pStack = &stack[size-1] ;
+	memset(stack, STACK_PAINT, size) ;
+}
+
+unsigned int Task::stackHighWater()
+{
+	unsigned int i = 0 ;
+
+	while (i < stackSize && stack[i] == STACK_PAINT)
+		i++ ;
+	return stackSize - i ;
+}
+
+//  When the root function for a task returns, it executes
+//  this function.
+void Task::taskDone()
+{
+   Scheduler::InstancePtr->removeTask(Scheduler::InstancePtr->activeTask) ;
+}
+
+// the calling task is put to sleep for cnt ticks of the system timer
+void Task::task_sleep(unsigned int cnt)
+{
+	if (cnt > 0)
+    {
+		cli() ;
+		makeTaskSleepBlocked() ;
+		TRACE(TRACE_SLEEP, traceId) ;
+		addSleeper(this, cnt) ;
+		Scheduler::InstancePtr->resched() ;
+	}
+}
+
+char Task::notify(unsigned int bits)
+{
+	notifyBits |= bits ;
+	if (!parameter.notifyWait || !(notifyBits & waitBits))
+		return FALSE ;
+	parameter.notifyWait = FALSE ;
+	Scheduler::InstancePtr->unblockTask(this) ;
+	return Scheduler::InstancePtr->outranks(this) ;
+}
+
+// returns the notification bits in mask that were taken, 0 on timeout
+unsigned int Task::waitNotify(unsigned int mask, unsigned int timeout)
+{
+	unsigned int bits ;
+
+	cli() ;
+	if (!(notifyBits & mask))
+	{
+		waitBits = mask ;
+		parameter.notifyWait = TRUE ;
+		Scheduler::InstancePtr->blockTimeout(NULL, timeout) ;
+		cli() ;
+	}
+	bits = notifyBits & mask ;
+	notifyBits &= ~mask ;
+	sei() ;
+	return bits ;
+}
+
+// Sleeps until the tick count reaches *lastWake + period, and advances 
+// *lastWake to that.  The wake time is absolute, so time spent between 
+// calls doesn't accumulate.  The difference is taken modulo 2^32, which 
+// stays correct across the tick count wrapping.
+// Returns FALSE without sleeping if the wake time has already passed.
+char Task::task_sleepUntil(unsigned long *lastWake, unsigned int period)
+{
+	long remaining ;
+
+	cli() ;
+	*lastWake += period ;
+	remaining = (long)(*lastWake - Scheduler::InstancePtr->tickCount) ;
+	if (remaining <= 0)
+	{
+#ifdef ARTK_EDF
+		// the next job is already due, so it starts now with the deadline
+		// its release time gives it
+		Scheduler::InstancePtr->jobDone() ;
+		deadline = *lastWake + relDeadline ;
+		Scheduler::InstancePtr->preempt() ;
+#endif
+		sei() ;
+		return FALSE ;
+	}
+	makeTaskSleepBlocked() ;
+	TRACE(TRACE_SLEEP, traceId) ;
+	addSleeper(this, (unsigned int)remaining) ;
+	Scheduler::InstancePtr->resched() ;
+	return TRUE ;
+}
+
+// builds the initial frame (see machine.h), so the first run of a task 
+// is resumed like any other
+void Task::PushScheduler() {
+	pStack = InitialFrame(stack, stackSize, rootFn, taskDone, glargeModel) ;
+#ifdef ARTK_TRACE
+	traceId = ++gtraceIds ;
+	traceEvent(TRACE_CREATE, traceId) ;
+#endif
+	Scheduler::InstancePtr->addNewTask(this) ;
+}
+
+//-------------------------------------------------------------
+// Stack arena
+
+unsigned char StackManager::arena[STACK_ARENA] 
+	__attribute__((aligned(sizeof(void *)))) ;
+StackManager StackManager::instance ;
+StackManager *StackManager::instPtr = &StackManager::instance ;
+
+StackManager::StackManager()
+{
+	pFree = (FreeBlock *)arena ;
+	pFree->pNext = NULL ;
+	pFree->size = STACK_ARENA & ~(sizeof(FreeBlock)-1) ;
+}
+
+
+unsigned int StackManager::roundSize(unsigned int size)
+{
+	return (size + sizeof(FreeBlock)-1) & ~(sizeof(FreeBlock)-1) ;
+}
+
+// first fit - the stack is taken from the top of the block so that the
+// header stays where it is
+unsigned char *StackManager::getStack(unsigned int size)
+{
+	unsigned char sreg = SREG ;
+	unsigned char *addr = NULL ;
+	FreeBlock *pBlock ;
+	FreeBlock *pOneBack = NULL ;
+
+	size = roundSize(size) ;
+	cli() ;
+	for (pBlock = pFree; pBlock != NULL; pBlock = pBlock->pNext)
+	{
+		if (pBlock->size >= size)
+		{
+			pBlock->size -= size ;
+			addr = (unsigned char *)pBlock + pBlock->size ;
+			// used up exactly, unlink it
+			if (pBlock->size == 0)
+			{
+				if (pOneBack == NULL)
+					pFree = pBlock->pNext ;
+				else
+					pOneBack->pNext = pBlock->pNext ;
+			}
+			break ;
+		}
+		pOneBack = pBlock ;
+	}
+	SREG = sreg ;
+	return addr ;
+}
+
+// put the block back in address order, merging it with its neighbours
+void StackManager::releaseStack(unsigned char *addr, unsigned int size)
+{
+	unsigned char sreg = SREG ;
+	FreeBlock *pNew = (FreeBlock *)addr ;
+	FreeBlock *pNext ;
+	FreeBlock *pOneBack = NULL ;
+
+	cli() ;
+	pNew->size = roundSize(size) ;
+	pNext = pFree ;
+	while (pNext != NULL && pNext < pNew)
+	{
+		pOneBack = pNext ;
+		pNext = pNext->pNext ;
+	}
+
+	if (pNext != NULL && addr + pNew->size == (unsigned char *)pNext)
+	{
+		pNew->size += pNext->size ;
+		pNew->pNext = pNext->pNext ;
+	}
+	else
+		pNew->pNext = pNext ;
+
+	if (pOneBack == NULL)
+		pFree = pNew ;
+	else if ((unsigned char *)pOneBack + pOneBack->size == addr)
+	{
+		pOneBack->size += pNew->size ;
+		pOneBack->pNext = pNew->pNext ;
+	}
+	else
+		pOneBack->pNext = pNew ;
+	SREG = sreg ;
+}
+
+unsigned int StackManager::freeBytes()
+{
+	unsigned char sreg = SREG ;
+	unsigned int total = 0 ;
+	FreeBlock *pBlock ;
+
+	cli() ;
+	for (pBlock = pFree; pBlock != NULL; pBlock = pBlock->pNext)
+		total += pBlock->size ;
+	SREG = sreg ;
+	return total ;
+}
+
+Task TaskManager::listTask[MAX_THREAD_LIST];
+DNode TaskManager::freeList ;
+
+TaskManager::TaskManager() {
+	unsigned char i;
+	for (i = 0; i < MAX_THREAD_LIST; i++)
+		freeList.addLast(&listTask[i].mylink) ;
+}
+
+TaskManager TaskManager::instance;
+TaskManager *TaskManager::instPtr = &TaskManager::instance;
+
+Task* TaskManager::getFreeTask() {
+	unsigned char sreg = SREG ;
+	Task *t ;
+
+	cli() ;
+	t = (Task *)freeList.removeFront() ;
+	if (t != NULL)
+		t->parameter.inUse = TRUE ;
+	SREG = sreg ;
+	return t ;
+}
+
+void TaskManager::releaseTask(Task *addr) {
+	unsigned char sreg = SREG ;
+
+	cli() ;
+	addr->parameter.inUse = FALSE ;
+	freeList.addLast(&addr->mylink) ;
+	SREG = sreg ;
+}
+
+char Scheduler::timerISR()
+{
+	char taskReady = FALSE;
+	DQNode *pWakeup ;
+	// Check for waiting tasks that have timed out, 
+    // sleeping tasks that must be woken and timers that expire
+	// decrement the count of the head of the sleepq
+	sleepDecrement() ;
+	
+	// get all those off the sleep q that are at 0
+	pWakeup = removeWaker() ;
+	while (pWakeup != NULL)
+	{
+#if MAX_TIMERS > 0
+		if (pWakeup->pTask == NULL)
+		{
+			if (((SoftTimer *)pWakeup)->expire())
+				taskReady = TRUE ;
+		}
+		else
+#endif
+		{
+            // either way (timed wait or just sleeping), it goes to ready list
+			wakeup(pWakeup->pTask) ;
+			taskReady = TRUE;
+		}
+
+        // see if anymore are at 0
+		pWakeup = removeWaker() ;
+	}
+	return taskReady;
+}
+
+//-------------------------------------------------------------
+// Semaphores
+
+Semaphore SemaphoreManager::listSema[MAX_SEMAPHORES];
+
+SemaphoreManager SemaphoreManager::instance;
+SemaphoreManager *SemaphoreManager::instPtr = &SemaphoreManager::instance;
+
+Semaphore *SemaphoreManager::getFreeSemaphore() {
+	unsigned char sreg = SREG ;
+	unsigned char i;
+
+	cli() ;
+	for (i = 0; i < MAX_SEMAPHORES; i++) {
+		if (!listSema[i].inUse) {
+			listSema[i].inUse = TRUE;
+			SREG = sreg ;
+			return &listSema[i];
+		}
+	}
+	SREG = sreg ;
+	return NULL;
+}
+
+// called with interrupts disabled
+char Semaphore::release()
+{
+	Task *t = Scheduler::InstancePtr->unblock(&waitList) ;
+
+	if (t == NULL)
+	{
+		count++ ;
+		return FALSE ;
+	}
+	return Scheduler::InstancePtr->outranks(t) ;
+}
+
+void Semaphore::wait()
+{
+	cli() ;
+	if (count > 0)
+	{
+		count-- ;
+		sei() ;
+	}
+	else
+		Scheduler::InstancePtr->block(&waitList) ;
+}
+
+void Semaphore::signal()
+{
+	cli() ;
+	if (release())
+		Scheduler::InstancePtr->preempt() ;
+	sei() ;
+}
+
+//-------------------------------------------------------------
+// Mutexes
+
+Mutex MutexManager::listMutex[MAX_MUTEXES];
+
+MutexManager MutexManager::instance;
+MutexManager *MutexManager::instPtr = &MutexManager::instance;
+
+Mutex *MutexManager::getFreeMutex() {
+	unsigned char sreg = SREG ;
+	unsigned char i;
+
+	cli() ;
+	for (i = 0; i < MAX_MUTEXES; i++) {
+		if (!listMutex[i].inUse) {
+			listMutex[i].inUse = TRUE;
+			SREG = sreg ;
+			return &listMutex[i];
+		}
+	}
+	SREG = sreg ;
+	return NULL;
+}
+
+unsigned char Task::inheritedPriority()
+{
+	unsigned char prio = basePriority ;
+	unsigned char waiter ;
+	Mutex *m ;
+
+	for (m = pHeld; m != NULL; m = m->pNextHeld)
+	{
+		waiter = m->topWaiter() ;
+		if (waiter > prio)
+			prio = waiter ;
+	}
+	return prio ;
+}
+
+unsigned char Mutex::topWaiter()
+{
+	if (waitList.isEmpty())
+		return 0 ;
+	return ((Task *)waitList.next())->getPriority() ;
+}
+
+// make t the owner
+void Mutex::take(Task *t)
+{
+	owner = t ;
+	lockCount = 1 ;
+	pNextHeld = t->pHeld ;
+	t->pHeld = this ;
+}
+
+void Mutex::lock()
+{
+	Scheduler *sched = Scheduler::InstancePtr ;
+	Task *self = sched->activeTask ;
+
+	cli() ;
+	if (owner == NULL)
+		take(self) ;
+	else if (owner == self)
+		lockCount++ ;
+	else
+	{
+		// lend our priority down the chain of owners, then wait for
+		// unlock() to hand the mutex over
+		self->pWaitMutex = this ;
+		sched->inherit(self) ;
+		sched->block(&waitList) ;
+		return ;
+	}
+	sei() ;
+}
+
+// off the owner's list of held mutexes, then to the highest waiter - any
+// waiters left behind are of lower or equal priority, so it needs no boost
+void Mutex::handOver()
+{
+	Task *next ;
+	Mutex **ppLink ;
+
+	for (ppLink = &owner->pHeld; *ppLink != this; ppLink = &(*ppLink)->pNextHeld)
+		;
+	*ppLink = pNextHeld ;
+
+	next = Scheduler::InstancePtr->unblock(&waitList) ;
+	if (next != NULL)
+	{
+		next->pWaitMutex = NULL ;
+		take(next) ;
+	}
+	else
+		owner = NULL ;
+}
+
+void Mutex::unlock()
+{
+	Scheduler *sched = Scheduler::InstancePtr ;
+	Task *self = sched->activeTask ;
+
+	cli() ;
+	if (owner != self || --lockCount > 0)
+	{
+		sei() ;
+		return ;
+	}
+
+	handOver() ;
+
+	// drop back to whatever the remaining mutexes call for
+	sched->changePriority(self, self->inheritedPriority()) ;
+	sched->preempt() ;
+	sei() ;
+}
+
+//-------------------------------------------------------------
+// Message queues
+
+#if MAX_QUEUES > 0
+MessageQueue QueueManager::listQueue[MAX_QUEUES];
+
+QueueManager QueueManager::instance;
+QueueManager *QueueManager::instPtr = &QueueManager::instance;
+
+MessageQueue *QueueManager::getFreeQueue() {
+	unsigned char sreg = SREG ;
+	unsigned char i;
+
+	cli() ;
+	for (i = 0; i < MAX_QUEUES; i++) {
+		if (!listQueue[i].inUse) {
+			listQueue[i].inUse = TRUE;
+			SREG = sreg ;
+			return &listQueue[i];
+		}
+	}
+	SREG = sreg ;
+	return NULL;
+}
+
+char MessageQueue::init(unsigned char size, unsigned char length)
+{
+	if (size == 0 || length == 0 || length == 255)
+		return FALSE ;
+	slots = length + 1 ;
+	buffer = StackManager::instPtr->getStack((unsigned int)size * slots) ;
+	if (buffer == NULL)
+		return FALSE ;
+	itemSize = size ;
+	head = tail = 0 ;
+	return TRUE ;
+}
+
+// copy the item in before publishing it by moving head
+// then wake the consumer if it is waiting
+char MessageQueue::put(const void *item)
+{
+	unsigned char next = nextSlot(head) ;
+
+	if (next == tail)
+		return FALSE ;
+	memcpy(buffer + head * itemSize, item, itemSize) ;
+	head = next ;
+	Scheduler::InstancePtr->unblock(&waitList) ;
+	return TRUE ;
+}
+
+char MessageQueue::send(const void *item)
+{
+	char sent ;
+
+	cli() ;
+	sent = put(item) ;
+	Scheduler::InstancePtr->preempt() ;
+	sei() ;
+	return sent ;
+}
+
+// copy the item out before releasing its slot by moving tail
+char MessageQueue::receive(void *item, unsigned int timeout)
+{
+	cli() ;
+	while (head == tail)
+	{
+		// an item may have arrived just as the timeout expired
+		if (!Scheduler::InstancePtr->blockTimeout(&waitList, timeout)
+		    && head == tail)
+			return FALSE ;
+		cli() ;
+	}
+	sei() ;
+	memcpy(item, buffer + tail * itemSize, itemSize) ;
+	tail = nextSlot(tail) ;
+	return TRUE ;
+}
+
+unsigned char MessageQueue::count()
+{
+	unsigned char h = head ;
+
+	return (h >= tail) ? h - tail : h + slots - tail ;
+}
+#endif
+
+//-------------------------------------------------------------
+// Event groups
+
+#if MAX_EVENTGROUPS > 0
+EventGroup EventGroupManager::listGroup[MAX_EVENTGROUPS];
+
+EventGroupManager EventGroupManager::instance;
+EventGroupManager *EventGroupManager::instPtr = &EventGroupManager::instance;
+
+EventGroup *EventGroupManager::getFreeGroup() {
+	unsigned char sreg = SREG ;
+	unsigned char i;
+
+	cli() ;
+	for (i = 0; i < MAX_EVENTGROUPS; i++) {
+		if (!listGroup[i].inUse) {
+			listGroup[i].inUse = TRUE;
+			SREG = sreg ;
+			return &listGroup[i];
+		}
+	}
+	SREG = sreg ;
+	return NULL;
+}
+
+char EventGroup::satisfied(unsigned int bits, unsigned int mask, 
+                           unsigned char mode)
+{
+	if (mode & EVENT_ALL)
+		return (bits & mask) == mask ;
+	return (bits & mask) != 0 ;
+}
+
+// returns the bits as they were when the wait was satisfied, 0 on timeout
+unsigned int EventGroup::wait(unsigned int mask, unsigned char mode, 
+                              unsigned int timeout)
+{
+	Task *self = Scheduler::InstancePtr->activeTask ;
+	unsigned int result ;
+
+	cli() ;
+	if (satisfied(bits, mask, mode))
+	{
+		result = bits ;
+		if (mode & EVENT_CLEAR)
+			bits &= ~mask ;
+		sei() ;
+		return result ;
+	}
+
+	// post() fills in waitBits with the bits that woke us
+	self->waitBits = mask ;
+	self->waitMode = mode ;
+	if (!Scheduler::InstancePtr->blockTimeout(&waitList, timeout))
+		return 0 ;
+	return self->waitBits ;
+}
+
+// wakes all the waiters the new bits satisfy, then clears the bits any of
+// them asked to clear
+void EventGroup::post(unsigned int mask)
+{
+	DNode *pLink ;
+	Task *t ;
+	unsigned int toClear = 0 ;
+
+	bits |= mask ;
+	pLink = waitList.next() ;
+	while (pLink != &waitList)
+	{
+		t = (Task *)pLink ;
+		pLink = pLink->next() ;
+		if (satisfied(bits, t->waitBits, t->waitMode))
+		{
+			if (t->waitMode & EVENT_CLEAR)
+				toClear |= t->waitBits ;
+			t->waitBits = bits ;
+			Scheduler::InstancePtr->unblockTask(t) ;
+		}
+	}
+	bits &= ~toClear ;
+}
+
+void EventGroup::set(unsigned int mask)
+{
+	cli() ;
+	post(mask) ;
+	Scheduler::InstancePtr->preempt() ;
+	sei() ;
+}
+
+void EventGroup::clear(unsigned int mask)
+{
+	cli() ;
+	bits &= ~mask ;
+	sei() ;
+}
+#endif
+
+//-------------------------------------------------------------
+// Deferred interrupt work
+
+#if DEFER_SIZE > 0
+volatile DeferQueue::DeferredCall DeferQueue::ring[DEFER_SIZE] ;
+volatile unsigned char DeferQueue::head = 0 ;
+volatile unsigned char DeferQueue::tail = 0 ;
+volatile unsigned int DeferQueue::overflows = 0 ;
+Task *DeferQueue::pWorker = NULL ;
+
+char DeferQueue::put(void (*fn)(void *), void *arg)
+{
+	unsigned char h = head ;
+	unsigned char next = (h + 1) & (DEFER_SIZE - 1) ;
+
+	if (pWorker == NULL || next == tail)
+	{
+		overflows++ ;
+		return FALSE ;
+	}
+	ring[h].fn = fn ;
+	ring[h].arg = arg ;
+	head = next ;
+	pWorker->notify(DEFER_NOTIFY) ;
+	return TRUE ;
+}
+
+// the worker task - a notification that arrives while it is draining is
+// left pending, so nothing put meanwhile is missed
+void DeferQueue::worker()
+{
+	unsigned char t ;
+	void (*fn)(void *) ;
+	void *arg ;
+
+	for (;;)
+	{
+		Scheduler::InstancePtr->activeTask->waitNotify(DEFER_NOTIFY, 
+		                                               ARTK_FOREVER) ;
+		t = tail ;
+		while (t != head)
+		{
+			fn = ring[t].fn ;
+			arg = ring[t].arg ;
+			t = (t + 1) & (DEFER_SIZE - 1) ;
+			tail = t ;
+			fn(arg) ;
+		}
+	}
+}
+#endif
+
+//-------------------------------------------------------------
+// Software timers
+
+#if MAX_TIMERS > 0
+SoftTimer TimerManager::listTimer[MAX_TIMERS];
+Task *TimerManager::pService = NULL ;
+SoftTimer *TimerManager::pDueHead = NULL ;
+SoftTimer *TimerManager::pDueTail = NULL ;
+
+TimerManager TimerManager::instance;
+TimerManager *TimerManager::instPtr = &TimerManager::instance;
+
+SoftTimer *TimerManager::getFreeTimer() {
+	unsigned char sreg = SREG ;
+	unsigned char i;
+
+	cli() ;
+	for (i = 0; i < MAX_TIMERS; i++) {
+		if (!listTimer[i].inUse) {
+			listTimer[i].inUse = TRUE;
+			SREG = sreg ;
+			return &listTimer[i];
+		}
+	}
+	SREG = sreg ;
+	return NULL;
+}
+
+// the timer service task - runs the callbacks of expired timers in order
+void TimerManager::service()
+{
+	SoftTimer *t ;
+
+	for (;;)
+	{
+		Scheduler::InstancePtr->activeTask->waitNotify(TIMER_NOTIFY, 
+		                                               ARTK_FOREVER) ;
+		for (;;)
+		{
+			cli() ;
+			t = pDueHead ;
+			if (t != NULL)
+			{
+				pDueHead = t->pNextDue ;
+				t->pending = FALSE ;
+			}
+			sei() ;
+			if (t == NULL)
+				break ;
+			t->callback(t->arg) ;
+		}
+	}
+}
+
+// called from the tick with the node off the sleep queue
+// An auto-reload timer goes straight back on, counting from when it was
+// due rather than from now, so it doesn't drift.  A timer that expires 
+// again before its callback has run is only run once.
+char SoftTimer::expire()
+{
+	if (period > 0)
+		insertSleeper(&node, period + node.dcount) ;
+	else
+		running = FALSE ;
+
+	if (pending)
+		return FALSE ;
+	pending = TRUE ;
+	pNextDue = NULL ;
+	if (TimerManager::pDueHead == NULL)
+		TimerManager::pDueHead = this ;
+	else
+		TimerManager::pDueTail->pNextDue = this ;
+	TimerManager::pDueTail = this ;
+	return TimerManager::pService->notify(TIMER_NOTIFY) ;
+}
+
+void SoftTimer::start(unsigned int ticks, unsigned int reload)
+{
+	cli() ;
+	if (running)
+		removeSleepNode(&node) ;
+	period = reload ;
+	running = TRUE ;
+	insertSleeper(&node, ticks > 0 ? ticks : 1) ;
+	sei() ;
+}
+
+// also drops a callback that is due but hasn't run yet
+void SoftTimer::stop()
+{
+	SoftTimer *p ;
+
+	cli() ;
+	if (running)
+	{
+		removeSleepNode(&node) ;
+		running = FALSE ;
+	}
+	if (pending)
+	{
+		if (TimerManager::pDueHead == this)
+		{
+			TimerManager::pDueHead = pNextDue ;
+		}
+		else
+		{
+			p = TimerManager::pDueHead ;
+			while (p->pNextDue != this)
+				p = p->pNextDue ;
+			p->pNextDue = pNextDue ;
+			if (TimerManager::pDueTail == this)
+				TimerManager::pDueTail = p ;
+		}
+		pending = FALSE ;
+	}
+	sei() ;
+}
+#endif
+
+//--------------------------------------------------------------------------
+// User-accessible constructs
+
+Task *ARTK_CreateTask(void (*rootFnPtr)(), unsigned stacksize, unsigned priority)
+{
+   Task *task = TaskManager::instPtr->getFreeTask();
+   unsigned char *stack ;
+
+   if (task == NULL)
+      return NULL ;
+   task->init() ;
+   if (stacksize < MIN_STACK)
+      stacksize = MIN_STACK ;
+   stack = StackManager::instPtr->getStack(stacksize) ;
+   if (stack == NULL)
+   {
+      TaskManager::releaseTask(task) ;
+      return NULL ;
+   }
+   task->setStack(stack, stacksize) ;
+   task->setFunction(rootFnPtr);
+   task->setPriority(clampPriority(priority));
+   task->PushScheduler();
+   return task ;
+}
+
+void ARTK_DeleteTask(TASK task)
+{
+   if (task == NULL)
+      task = Scheduler::InstancePtr->activeTask ;
+   // the timer service and the defer worker are the kernel's - timers and
+   // ARTK_DeferFromISR would be left calling a task that had gone
+#if MAX_TIMERS > 0
+   if (task == TimerManager::pService)
+      return ;
+#endif
+#if DEFER_SIZE > 0
+   if (task == DeferQueue::pWorker)
+      return ;
+#endif
+   Scheduler::InstancePtr->removeTask(task) ;
+}
+
+char ARTK_Join(TASK task, unsigned timeout)
+{
+   return Scheduler::InstancePtr->join(task, timeout) ;
+}
+
+void ARTK_SetTimeSlice(unsigned priority, unsigned ticks)
+{
+   Scheduler *sched = Scheduler::InstancePtr ;
+
+   cli() ;
+   sched->timeSlice[clampPriority(priority)-1] = 
+      (unsigned char)(ticks > 255 ? 255 : ticks) ;
+   sei() ;
+}
+
+void ARTK_SetPriority(TASK task, unsigned priority)
+{
+   Scheduler::InstancePtr->setPriority(task, clampPriority(priority)) ;
+}
+
+unsigned ARTK_GetPriority(TASK task)
+{
+   return task->getPriority() ;
+}
+
+#ifdef ARTK_EDF
+void ARTK_SetDeadline(TASK task, unsigned ticks)
+{
+   Scheduler *sched = Scheduler::InstancePtr ;
+
+   sched->setDeadline(task == NULL ? sched->activeTask : task, ticks) ;
+}
+
+unsigned ARTK_GetDeadlineMisses(TASK task)
+{
+   return Scheduler::InstancePtr->takeMisses(task) ;
+}
+#endif
+
+unsigned ARTK_StackHighWater(TASK task)
+{
+   return task->stackHighWater() ;
+}
+
+unsigned ARTK_StackLeft()
+{
+   return Scheduler::InstancePtr->stackLeft() ;
+}
+
+void ARTK_SetStackOverflowHook(void (*hook)(TASK))
+{
+   gstackHook = hook ;
+}
+
+unsigned ARTK_StackArenaFree()
+{
+   return StackManager::instPtr->freeBytes() ;
+}
+
+SEMAPHORE ARTK_CreateSemaphore(int initialCount)
+{
+   Semaphore *sema = SemaphoreManager::instPtr->getFreeSemaphore() ;
+
+   if (sema != NULL)
+      sema->init(initialCount) ;
+   return sema ;
+}
+
+void ARTK_Wait(SEMAPHORE sema)
+{
+   sema->wait() ;
+}
+
+void ARTK_Signal(SEMAPHORE sema)
+{
+   sema->signal() ;
+}
+
+char ARTK_SignalFromISR(SEMAPHORE sema)
+{
+   return sema->signalFromISR() ;
+}
+
+void ARTK_Notify(TASK task, unsigned bits)
+{
+   cli() ;
+   if (task->notify(bits))
+      Scheduler::InstancePtr->preempt() ;
+   sei() ;
+}
+
+char ARTK_NotifyFromISR(TASK task, unsigned bits)
+{
+   return task->notify(bits) ;
+}
+
+unsigned ARTK_WaitNotify(unsigned mask, unsigned timeout)
+{
+   return Scheduler::InstancePtr->activeTask->waitNotify(mask, timeout) ;
+}
+
+void ARTK_YieldFromISR()
+{
+   Scheduler::InstancePtr->preemptFromISR() ;
+}
+
+MUTEX ARTK_CreateMutex()
+{
+   return MutexManager::instPtr->getFreeMutex() ;
+}
+
+void ARTK_LockMutex(MUTEX mutex)
+{
+   mutex->lock() ;
+}
+
+void ARTK_UnlockMutex(MUTEX mutex)
+{
+   mutex->unlock() ;
+}
+
+#if MAX_QUEUES > 0
+QUEUE ARTK_CreateQueue(unsigned char itemSize, unsigned char length)
+{
+   MessageQueue *queue = QueueManager::instPtr->getFreeQueue() ;
+
+   if (queue != NULL && !queue->init(itemSize, length))
+   {
+      queue->inUse = FALSE ;
+      queue = NULL ;
+   }
+   return queue ;
+}
+
+char ARTK_QueueSend(QUEUE queue, const void *item)
+{
+   return queue->send(item) ;
+}
+
+char ARTK_QueueSendFromISR(QUEUE queue, const void *item)
+{
+   return queue->put(item) ;
+}
+
+char ARTK_QueueReceive(QUEUE queue, void *item, unsigned timeout)
+{
+   return queue->receive(item, timeout) ;
+}
+
+unsigned char ARTK_QueueCount(QUEUE queue)
+{
+   return queue->count() ;
+}
+#endif
+
+#if MAX_EVENTGROUPS > 0
+EVENTGROUP ARTK_CreateEventGroup()
+{
+   return EventGroupManager::instPtr->getFreeGroup() ;
+}
+
+unsigned ARTK_WaitAny(EVENTGROUP group, unsigned mask, char clearOnExit,
+                      unsigned timeout)
+{
+   return group->wait(mask, clearOnExit ? EVENT_CLEAR : 0, timeout) ;
+}
+
+unsigned ARTK_WaitAll(EVENTGROUP group, unsigned mask, char clearOnExit,
+                      unsigned timeout)
+{
+   return group->wait(mask, EVENT_ALL | (clearOnExit ? EVENT_CLEAR : 0), 
+                      timeout) ;
+}
+
+void ARTK_SetEvents(EVENTGROUP group, unsigned mask)
+{
+   group->set(mask) ;
+}
+
+void ARTK_SetEventsFromISR(EVENTGROUP group, unsigned mask)
+{
+   group->post(mask) ;
+}
+
+void ARTK_ClearEvents(EVENTGROUP group, unsigned mask)
+{
+   group->clear(mask) ;
+}
+
+unsigned ARTK_GetEvents(EVENTGROUP group)
+{
+   return group->get() ;
+}
+#endif
+
+#if MAX_TIMERS > 0
+TIMER ARTK_CreateTimer(void (*fn)(void *), void *arg)
+{
+   SoftTimer *timer ;
+
+   // the service task is only created once there is a timer to serve
+   if (TimerManager::pService == NULL)
+   {
+      TimerManager::pService = ARTK_CreateTask(TimerManager::service, 
+                                               TIMER_STACK, TIMER_PRIORITY) ;
+      if (TimerManager::pService == NULL)
+         return NULL ;
+   }
+   timer = TimerManager::instPtr->getFreeTimer() ;
+   if (timer != NULL)
+      timer->setCallback(fn, arg) ;
+   return timer ;
+}
+
+void ARTK_StartTimer(TIMER timer, unsigned ticks, unsigned period)
+{
+   timer->start(ticks, period) ;
+}
+
+void ARTK_StopTimer(TIMER timer)
+{
+   timer->stop() ;
+}
+
+char ARTK_TimerRunning(TIMER timer)
+{
+   return timer->isRunning() ;
+}
+#endif
+
+#if DEFER_SIZE > 0
+char ARTK_CreateDeferWorker()
+{
+   if (DeferQueue::pWorker == NULL)
+      DeferQueue::pWorker = ARTK_CreateTask(DeferQueue::worker, 
+                                            DEFER_STACK, DEFER_PRIORITY) ;
+   return DeferQueue::pWorker != NULL ;
+}
+
+char ARTK_DeferFromISR(void (*fn)(void *), void *arg)
+{
+   return DeferQueue::put(fn, arg) ;
+}
+
+unsigned ARTK_DeferOverflows()
+{
+   unsigned overflows ;
+
+   cli() ;
+   overflows = DeferQueue::overflows ;
+   sei() ;
+   return overflows ;
+}
+#endif
+
+void ARTK_TerminateMultitasking()
+{
+   exit(0) ;
+}
+
+void ARTK_SetOptions(int iLargeModel, int iIdleMode, int iTickInterval)
 {
    if (iLargeModel == -1)
       glargeModel = FALSE ;
    else
       glargeModel = iLargeModel ;
+
+   if (iIdleMode == -1)
+      gidleMode = ARTK_IDLE_SLEEP ;
+   else
+      gidleMode = iIdleMode ;
+
+   if (iTickInterval <= 0)
+      gtickInterval = DEFAULT_TICK ;
+   else
+      gtickInterval = iTickInterval ;
+}
+
+unsigned long ARTK_GetTicks()
+{
+   unsigned long ticks ;
+
+   cli() ;
+   ticks = Scheduler::InstancePtr->tickCount ;
+   sei() ;
+   return ticks ;
+}
+
+void ARTK_GetIdleStats(unsigned long *entries, unsigned long *cycles)
+{
+   cli() ;
+   *entries = Scheduler::InstancePtr->idleEntries ;
+   *cycles = Scheduler::InstancePtr->sleptCycles ;
+   sei() ;
+}
+
+#ifdef ARTK_STATS
+char ARTK_GetTaskStats(TASK task, TASKSTATS *stats)
+{
+   Scheduler *sched = Scheduler::InstancePtr ;
+
+   if (task != NULL && !task->parameter.inUse)
+      return FALSE ;
+   cli() ;
+   sched->account() ;
+   *stats = *sched->statsOf(task) ;
+   sei() ;
+   return TRUE ;
+}
+
+unsigned long ARTK_GetStatsWindow()
+{
+   Scheduler *sched = Scheduler::InstancePtr ;
+   unsigned long window ;
+
+   cli() ;
+   sched->account() ;
+   window = sched->statsStamp - sched->windowStart ;
+   sei() ;
+   return window ;
+}
+
+void ARTK_ResetStats()
+{
+   Scheduler::InstancePtr->resetStats() ;
 }
+#endif
 
 //-------------------------------------------------------------------------
 // Main and Idle tasks, startup functions
 
 extern void SetupARTK() ;
 
+// the initial frames are built after SetupARTK(), which may change the 
+// code address size through ARTK_SetOptions
+static void startStaticTasks()
+{
+   DQNode *pNode = gstaticTasks ;
+   Task *t ;
+
+   while (pNode != NULL)
+   {
+      t = pNode->pTask ;
+      pNode = pNode->pNext ;
+      t->sleepNode.pNext = NULL ;
+      t->setStack(t->stack, t->stackSize) ;
+      t->PushScheduler() ;
+   }
+   gstaticTasks = NULL ;
+}
+
 void setup()
 {
    glargeModel = FALSE ;
-   Scheduler::Instance();
-   DQNodeManager::Instance();
-   TaskManager::Instance();
+   gidleMode = ARTK_IDLE_SLEEP ;
+   gtickInterval = DEFAULT_TICK ;
 
    SetupARTK() ;
+   startStaticTasks() ;
 
    Scheduler::InstancePtr->startMultiTasking() ;
 }
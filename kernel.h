@@ -32,7 +32,8 @@
 // Modifications by SYLVESTRE François
 
 // Usage Notes:
-// ARTK makes use of the Arduino TimerOne library, which is distributed with it.
+// ARTK drives its tick from a Timer1 compare interrupt, so the TimerOne
+// library (or anything else that uses Timer1) can't be used alongside it.
 // You must NOT implement a setup() function
 // Implement a Setup() function instead - ARTK will call it for you
 // You must NOT implement a loop() function
@@ -51,14 +52,22 @@
 #define FALSE 0 
 
 // just won't work w/ less than MIN_STACK
-#if defined(__AVR_ATmega328P__)
+// the tick interrupt pushes a full frame (about 40 bytes) and runs the 
+// scheduler on the stack of whichever task it interrupts - through the
+// sleep queue, timer expiry, and the stats, trace and EDF code when they
+// are built in.  Don't lower it without measuring that path's depth with
+// every option enabled (ARTK_StackHighWater).
+#ifdef __AVR__
 	#define MIN_STACK 128
-#elif defined (__AVR_ATmega1280__)
-	#define MIN_STACK 256
-#elif defined (__AVR_ATmega2560__)
-	#define MIN_STACK 384
 #else
-	#define MIN_STACK 128
+	// the host port, where the C library wants room too
+	#define MIN_STACK 8192
+#endif
+
+// Task stacks are carved out of one static arena.  By default it holds as
+// much as the fixed per-task stacks used to, but it can be set at build time
+#ifndef STACK_ARENA
+	#define STACK_ARENA (MAX_THREAD_LIST * DEFAULT_STACK)
 #endif
 
 // task states
@@ -67,16 +76,82 @@
 #define TASK_BLOCKED       3    // Task is blocked on a semaphore
 #define SLEEP_BLOCKED      4    // Task is sleeping
 
-#define MAX_THREAD_LIST    5	// Max 5 threads
+// Task slots, including Main.  Tasks cost RAM for their descriptor (about
+// 40 bytes) even while unused, so this is best kept to what is needed.
+#ifndef MAX_THREAD_LIST
+	#define MAX_THREAD_LIST 5
+#endif
+
+// Kernel objects come from fixed pools, which take their RAM whether they
+// are used or not, so each is best kept to what the sketch needs.  The 
+// cost per object on the AVR is given with each.  The optional features
+// (queues, event groups, timers and deferral) are left out altogether 
+// when their pool is 0, as they are by default - build with, say, 
+// -DMAX_TIMERS=4 to have them.
+
+// 7 bytes each
+#ifndef MAX_SEMAPHORES
+	#define MAX_SEMAPHORES 4
+#endif
+
+// 10 bytes each
+#ifndef MAX_MUTEXES
+	#define MAX_MUTEXES 2
+#endif
+
+// 11 bytes each, plus the buffer from the stack arena
+#ifndef MAX_QUEUES
+	#define MAX_QUEUES 0
+#endif
+
+// 7 bytes each
+#ifndef MAX_EVENTGROUPS
+	#define MAX_EVENTGROUPS 0
+#endif
+
+// Software timers, 19 bytes each, and the task that runs their callbacks
+#ifndef MAX_TIMERS
+	#define MAX_TIMERS 0
+#endif
+#ifndef TIMER_PRIORITY
+	#define TIMER_PRIORITY MAX_PRIORITY
+#endif
+#ifndef TIMER_STACK
+	#define TIMER_STACK DEFAULT_STACK
+#endif
+
+// Interrupt work deferred to the worker task - DEFER_SIZE calls can be
+// waiting (a power of 2, at most 128), at 4 bytes each
+#ifndef DEFER_SIZE
+	#define DEFER_SIZE 0
+#endif
+#if (DEFER_SIZE & (DEFER_SIZE - 1)) || DEFER_SIZE > 128
+	#error "DEFER_SIZE must be a power of 2, at most 128"
+#endif
+#ifndef DEFER_PRIORITY
+	#define DEFER_PRIORITY MAX_PRIORITY
+#endif
+#ifndef DEFER_STACK
+	#define DEFER_STACK DEFAULT_STACK
+#endif
+
+// user priorities run from 1 (lowest) to PRIORITY_LEVELS (highest)
+// the ready bitmap in the scheduler is 16 bits wide, one bit per level
+#define PRIORITY_LEVELS    16
+#define MIN_PRIORITY       1
+#define MAX_PRIORITY       PRIORITY_LEVELS
 
 // Define structure with field byte for Task
-// This is for state & firstrun & inUse
+// This is for state & inUse, and for a blocked task whether it is also on
+// the sleep queue (timed) and whether the timeout ended the wait (timedOut)
 
 typedef struct TaskParameter {
-	unsigned char state : 2;
-	unsigned char firstRun : 2;
-	unsigned char inUse : 2;
-	unsigned char : 2;
+	unsigned char state : 3;
+	unsigned char inUse : 1;
+	unsigned char timed : 1;
+	unsigned char timedOut : 1;
+	unsigned char notifyWait : 1;
+	unsigned char isStatic : 1;	// declared with ARTK_TASK, not from the pool
 } TaskParameter;
 
 // The scheduler maintains an array of circular lists - one for each priority.
@@ -95,11 +170,19 @@ private:
 public:
 	int isEmpty() { return (pNext == this) ; }
 
+    // for walking a list - when called on a head node, returns the front
+	DNode *next() { return pNext ; }
+
     // Insert passed node before this node
     // when called on a head node, this adds at the end of the circular list
     #define addLast insertBefore
 	void insertBefore(DNode *link) ;
 
+    // Insert passed node after this node
+    // when called on a head node, this adds at the front of the circular list
+    #define addFirst insertAfter
+	void insertAfter(DNode *link) ;
+
     // Remove the next object from the queue and return a pointer to it
     // when called on a head node this removes the item at the front of the queue
     #define removeFront removeNext
@@ -113,12 +196,89 @@ public:
 	~DNode() {}
 };
 
+// Scheduler trace
+// Built only with ARTK_TRACE defined.  Each event is a type, an argument
+// (usually a task's traceId) and a timestamp of the low 16 bits of the 
+// tick count plus the timer counts into that tick.  Events go into a ring
+// of TRACE_SIZE, the oldest being overwritten when it is full.
+// extras/trace/artk_trace.py decodes the stream ARTK_TraceDrain sends.
+#define TRACE_START      0    // sent by the drain - tick in us, counts per tick
+#define TRACE_LOST       1    // sent by the drain - events overwritten
+#define TRACE_SWITCH     2    // task arg now runs
+#define TRACE_CREATE     3    // task arg started
+#define TRACE_EXIT       4    // task arg ended
+#define TRACE_SLEEP      5    // task arg went to sleep
+#define TRACE_WAKE       6    // task arg woken by the sleep queue
+#define TRACE_BLOCK      7    // task arg blocked on a wait list
+#define TRACE_UNBLOCK    8    // task arg readied from a wait list
+#define TRACE_IDLE       9    // nothing ready, the processor sleeps
+#define TRACE_IDLE_END   10
+#define TRACE_TICK       11   // arg ticks credited
+#define TRACE_ISR        12   // user interrupt handler arg entered
+#define TRACE_ISR_END    13
+#define TRACE_MARK       14   // user marker arg
+
+#ifdef ARTK_TRACE
+	#ifndef TRACE_SIZE
+		#define TRACE_SIZE 64
+	#endif
+	// ticks between drains
+	#ifndef TRACE_DRAIN_TICKS
+		#define TRACE_DRAIN_TICKS 20
+	#endif
+
+	typedef struct TraceEvent {
+		uint8_t type ;
+		uint8_t arg ;
+		uint16_t tick ;
+		uint16_t phase ;
+	} TraceEvent ;
+
+	// safe with interrupts enabled or not
+	void traceEvent(unsigned char type, unsigned char arg) ;
+	#define TRACE(type, arg)  traceEvent(type, arg)
+#else
+	#define TRACE(type, arg)
+#endif
+
+// Run time statistics
+// Built only with ARTK_STATS defined.  The CPU time is charged to the 
+// task that had it on every switch and tick, in CPU cycles as measured
+// by the tick timer.
+#ifdef ARTK_STATS
+	typedef struct TaskStats {
+		unsigned long runCycles ;   // CPU cycles run
+		unsigned int switches ;     // times switched in
+		unsigned int preemptions ;  // times switched out while still ready
+	} TaskStats ;
+#endif
+
+// Stacks are painted with this when a task is created
+#define STACK_PAINT  0xA5
+
+class Mutex ;
+class Task ;
+
+// Sleep queue node - see the Sleep Queue in kernel.cpp
+// Every task has one, so sleeping never allocates.  pTask is NULL for a 
+// software timer's node.
+class DQNode
+{
+public:
+	Task *pTask ;
+	DQNode *pNext ;
+	long dcount ;
+};
+
 // Task (process descriptor) class
 class Task
 {
 private:
     // This should probably be cleaned up
 	friend class Scheduler ;
+	friend class Mutex ;
+	friend class EventGroup ;
+	friend class TaskManager ;
 
     // This links the task into a doubly-linked list
 	DNode mylink ;
@@ -127,12 +287,69 @@ private:
 	unsigned char *pStack ;
 
     void (*rootFn)() ;
+
+    // 1 (lowest) to PRIORITY_LEVELS (highest)
+    // priority is the effective one, which a mutex may raise above the
+    // basePriority the task was given
+	unsigned char priority ;
+	unsigned char basePriority ;
+
+    // the list the task is blocked on, if any
+	DNode *pWaitList ;
+
+    // mutexes held (linked through Mutex::pNextHeld), and the one waited on
+	Mutex *pHeld ;
+	Mutex *pWaitMutex ;
+
+    // what a task waiting on an event group waits for (EVENT_ flags), and
+    // then the bits that satisfied it.  A task waiting for a notification
+    // keeps its mask in waitBits too.
+	unsigned int waitBits ;
+	unsigned char waitMode ;
+
+    // notification bits posted to the task and not yet taken
+	unsigned int notifyBits ;
+
+    // ticks run of the current time slice - see Scheduler::slice
+	unsigned char sliceUsed ;
+
+    // tasks waiting in ARTK_Join for this one to end
+	DNode joinList ;
+
+#ifdef ARTK_TRACE
+    // numbers the tasks in the trace, a new one each time a task starts
+	unsigned char traceId ;
+#endif
+
+#ifdef ARTK_STATS
+	TaskStats stats ;
+    // stats are zeroed the first time they are touched after a reset - 
+    // this is the Scheduler::statsEpoch they belong to
+	unsigned char statsEpoch ;
+#endif
+
+#ifdef ARTK_EDF
+    // relative deadline in ticks (0 for none), the absolute deadline of 
+    // the current job, and the number of jobs that finished late
+	unsigned int relDeadline ;
+	unsigned long deadline ;
+	unsigned int misses ;
+#endif
+
+    // the priority the held mutexes call for - the base priority or that
+    // of the highest waiter, whichever is higher
+	unsigned char inheritedPriority() ;
+
     // This method is executed when a task returns from it's root function
     static void taskDone();
 
 public:
-    // Task's stack	and root function pointer
-    unsigned char stack[MIN_STACK];
+    // puts the task on the sleep queue
+	DQNode sleepNode ;
+
+    // Task's stack, allocated from the stack arena
+    unsigned char *stack ;
+    unsigned int stackSize ;
     TaskParameter parameter;
 
     // These change the task state.
@@ -141,12 +358,33 @@ public:
 	void makeTaskBlocked(){ parameter.state = TASK_BLOCKED ; }
 	void makeTaskSleepBlocked(){ parameter.state = SLEEP_BLOCKED ; }
 	void setFunction(void (*rootFnPtr)()) { rootFn = rootFnPtr; }
+	void setPriority(unsigned char prio) { priority = basePriority = prio; }
+	unsigned char getPriority() { return priority; }
+	void setStack(unsigned char *base, unsigned int size) ;
+
+    // bytes of stack that have ever been used, found by scanning up from 
+    // the bottom for the end of the paint pattern
+	unsigned int stackHighWater() ;
 	void PushScheduler();
 
     // called by the user's sleep() wrapper function.
 	void task_sleep(unsigned time);
+	char task_sleepUntil(unsigned long *lastWake, unsigned int period) ;
+
+    // Notifications need no wait list - a task waiting for one is blocked 
+    // on no list with parameter.notifyWait set.
+    // notify() runs with interrupts disabled, and returns TRUE if it readied
+    // the task and the task outranks the active one
+	char notify(unsigned int bits) ;
+	unsigned int waitNotify(unsigned int mask, unsigned int timeout) ;
+
+    // clears what a previous task in this slot may have left behind
+	void init() ;
 
 	Task();
+    // for ARTK_TASK - the stack is the caller's, not from the arena
+	Task(void (*rootFnPtr)(), unsigned prio, unsigned char *base, 
+	     unsigned int size);
 	   
     // destructor cleans up the stack space
     // the new and delete operators are broken for arrays in AVR
@@ -154,43 +392,295 @@ public:
 } ;
 
 
-////TEST
+// Free tasks wait on freeList through their mylink, so getting and 
+// releasing one take constant time however many slots there are
 class TaskManager
 {
 private:
 	static Task listTask[MAX_THREAD_LIST];
-	TaskManager() {};
+	static DNode freeList ;
+	TaskManager() ;
+	static TaskManager instance;
 public:
 	static TaskManager *instPtr;
-	static void Instance();
 	Task *getFreeTask();
 	static void releaseTask(Task *addr);
 };
 
-class DQNode
+// Counting semaphore
+// Blocked tasks wait on waitList through their mylink, highest priority
+// first (FIFO within a priority), so a signal always wakes the most 
+// important waiter.
+class Semaphore
 {
+private:
+	int count ;
+	DNode waitList ;
+
+	// wakes a waiter, or counts the signal if there is none
+	// returns TRUE if the woken task outranks the active task
+	char release() ;
+
 public:
-	Task *pTask ;
-	DQNode *pNext ;
-	long dcount ;
-	unsigned long start;
-	char inUse = FALSE;
+	char inUse ;
+
+	void init(int initialCount) { count = initialCount ; }
+	void wait() ;
+	void signal() ;
+	char signalFromISR() { return release() ; }
+
+	Semaphore() { count = 0 ; inUse = FALSE ; }
+} ;
+
+class SemaphoreManager
+{
+private:
+	static Semaphore listSema[MAX_SEMAPHORES];
+	SemaphoreManager() {};
+	static SemaphoreManager instance;
+public:
+	static SemaphoreManager *instPtr;
+	Semaphore *getFreeSemaphore();
 };
 
-class DQNodeManager
+// Mutex with priority inheritance
+// While a task of higher priority waits, the owner runs at that priority,
+// and so on down the chain if the owner itself waits on another mutex.
+// The owner drops back when it unlocks.  Locks nest for the owner.
+class Mutex
 {
 private:
-	// List of DQNode (static allocation memory)
-	static DQNode DQList[MAX_THREAD_LIST];
-	// Constructor of DQNodeManager
-	DQNodeManager() {};
+	friend class Task ;
+	friend class Scheduler ;
+
+	Task *owner ;
+	unsigned char lockCount ;
+	Mutex *pNextHeld ;
+	DNode waitList ;
+
+	// priority of the highest waiter, 0 if none
+	unsigned char topWaiter() ;
+	void take(Task *t) ;
+	// passes the mutex from its owner to the highest waiter, or frees it
+	void handOver() ;
 
 public:
-	static DQNodeManager *instPtr;
-	static void Instance();
-	DQNode *getFreeDQNode();
-	void releaseDQNode(DQNode *addr);
+	char inUse ;
+
+	void lock() ;
+	void unlock() ;
+
+	Mutex() { owner = NULL ; lockCount = 0 ; pNextHeld = NULL ; inUse = FALSE ; }
+} ;
+
+class MutexManager
+{
+private:
+	static Mutex listMutex[MAX_MUTEXES];
+	MutexManager() {};
+	static MutexManager instance;
+public:
+	static MutexManager *instPtr;
+	Mutex *getFreeMutex();
+};
+
+#if MAX_QUEUES > 0
+// Fixed item size message queue
+// A ring buffer with one producer, typically an interrupt handler, and one
+// consumer task.  The producer only ever writes head and the consumer only
+// tail, so neither side has to disable interrupts to move data.  A slot is
+// kept empty to tell a full queue from an empty one.
+// The consumer blocks on waitList while the queue is empty.
+// The buffer comes from the stack arena.
+class MessageQueue
+{
+private:
+	unsigned char *buffer ;
+	unsigned char itemSize ;
+	unsigned char slots ;
+	volatile unsigned char head ;
+	volatile unsigned char tail ;
+	DNode waitList ;
+
+	unsigned char nextSlot(unsigned char slot) 
+		{ return (slot+1 == slots) ? 0 : slot+1 ; }
+
+public:
+	char inUse ;
+
+	char init(unsigned char size, unsigned char length) ;
+	// with interrupts disabled - from an interrupt handler or the kernel
+	char put(const void *item) ;
+	char send(const void *item) ;
+	char receive(void *item, unsigned int timeout) ;
+	unsigned char count() ;
+
+	MessageQueue() { inUse = FALSE ; }
+} ;
+
+class QueueManager
+{
+private:
+	static MessageQueue listQueue[MAX_QUEUES];
+	QueueManager() {};
+	static QueueManager instance;
+public:
+	static QueueManager *instPtr;
+	MessageQueue *getFreeQueue();
+};
+#endif
+
+#if MAX_EVENTGROUPS > 0
+// Event flag group
+// Tasks wait for any or all of a set of bits.  Setting bits wakes every
+// waiter they satisfy in one pass over waitList.
+#define EVENT_ALL     1    // wait for all bits, rather than any
+#define EVENT_CLEAR   2    // clear the bits waited for on the way out
+
+class EventGroup
+{
+private:
+	volatile unsigned int bits ;
+	DNode waitList ;
+
+	static char satisfied(unsigned int bits, unsigned int mask, 
+	                      unsigned char mode) ;
+
+public:
+	char inUse ;
+
+	unsigned int wait(unsigned int mask, unsigned char mode, 
+	                  unsigned int timeout) ;
+	// with interrupts disabled - from an interrupt handler or the kernel
+	void post(unsigned int mask) ;
+	void set(unsigned int mask) ;
+	void clear(unsigned int mask) ;
+	unsigned int get() { return bits ; }
+
+	EventGroup() { bits = 0 ; inUse = FALSE ; }
+} ;
+
+class EventGroupManager
+{
+private:
+	static EventGroup listGroup[MAX_EVENTGROUPS];
+	EventGroupManager() {};
+	static EventGroupManager instance;
+public:
+	static EventGroupManager *instPtr;
+	EventGroup *getFreeGroup();
+};
+#endif
+
+// First-fit allocator for the stack arena.
+// Free space is a list of blocks sorted by address, each starting with a 
+// FreeBlock header.  Sizes are rounded up to a multiple of the header size,
+// so whatever is left of a block after a split can always hold a header.
+class StackManager
+{
+private:
+	struct FreeBlock
+	{
+		FreeBlock *pNext ;
+		unsigned int size ;
+	} ;
+
+	static unsigned char arena[] ;
+	FreeBlock *pFree ;
+	StackManager() ;
+	static StackManager instance ;
+
+	static unsigned int roundSize(unsigned int size) ;
+
+public:
+	static StackManager *instPtr ;
+	unsigned char *getStack(unsigned int size) ;
+	void releaseStack(unsigned char *addr, unsigned int size) ;
+	unsigned int freeBytes() ;
+};
+
+#if MAX_TIMERS > 0
+// Software timer
+// A timer waits on the sleep queue like a sleeping task, through a DQNode
+// of its own with no pTask.  When it expires the tick queues it for the
+// timer service task, which runs the callback.
+class SoftTimer
+{
+private:
+	friend class TimerManager ;
+
+    // must stay first - the sleep queue node is cast back to the timer
+	DQNode node ;
+	void (*callback)(void *arg) ;
+	void *arg ;
+	unsigned int period ;	// 0 for a one-shot timer
+	SoftTimer *pNextDue ;	// queue of timers waiting for their callback
+	char running ;
+	char pending ;
+
+public:
+	char inUse ;
+
+	void setCallback(void (*fn)(void *), void *a) { callback = fn ; arg = a ; }
+	void start(unsigned int ticks, unsigned int reload) ;
+	void stop() ;
+	char isRunning() { return running ; }
+	// called by the tick, returns TRUE if it readied the service task
+	char expire() ;
+
+	SoftTimer() { node.pTask = NULL ; running = pending = inUse = FALSE ; }
+} ;
+
+// the notification bit that wakes the timer service task
+#define TIMER_NOTIFY  1
+
+class TimerManager
+{
+private:
+	static SoftTimer listTimer[MAX_TIMERS];
+	TimerManager() {};
+	static TimerManager instance;
+public:
+	static TimerManager *instPtr;
+	SoftTimer *getFreeTimer();
+
+	static Task *pService ;
+	static SoftTimer *pDueHead ;
+	static SoftTimer *pDueTail ;
+	static void service() ;
 };
+#endif
+
+#if DEFER_SIZE > 0
+// the notification bit that wakes the defer worker
+#define DEFER_NOTIFY  1
+
+// Calls deferred by interrupt handlers, run in order by the worker task.
+// The ring has one writer, the interrupt handlers (which don't nest), and
+// one reader, the worker, so neither side needs to disable interrupts:
+// each owns its index, and a slot is filled before head moves past it and
+// read before tail does.
+class DeferQueue
+{
+private:
+	struct DeferredCall
+	{
+		void (*fn)(void *arg) ;
+		void *arg ;
+	} ;
+	static volatile DeferredCall ring[DEFER_SIZE] ;
+	static volatile unsigned char head ;
+	static volatile unsigned char tail ;
+public:
+	static Task *pWorker ;
+	// calls that didn't fit
+	static volatile unsigned int overflows ;
+
+	// from an interrupt handler, FALSE if the ring is full
+	static char put(void (*fn)(void *), void *arg) ;
+	static void worker() ;
+};
+#endif
 
 // this class implements the ARTK task scheduler
 class Scheduler
@@ -198,7 +688,14 @@ class Scheduler
 private:
     // For each priority level, the scheduler maintains a queue 
     // of process descriptors for that are ready to run.
-	DNode readyList; //[PRIORITY_LEVELS] ;
+    // With ARTK_EDF each queue is kept in deadline order.
+	DNode readyList[PRIORITY_LEVELS] ;
+
+    // Bit (priority-1) is set when readyList[priority-1] is not empty
+	unsigned int readyMask ;
+
+    // index of the highest non-empty ready list - only valid if readyMask != 0
+	unsigned char topReady() ;
 
     // Total number of tasks, including the Main task
 	unsigned char numTasks ;
@@ -214,25 +711,136 @@ public:
 	void startMultiTasking() ;
 
     // returns the stack space left for the active task
-    //unsigned int stackLeft() ;
+    unsigned int stackLeft() ;
+
+    // calls the overflow hook if sp is below the stack of t or its
+    // bottom byte no longer holds the paint pattern
+	void checkStack(Task *t, unsigned char *sp) ;
 
     // add/remove tasks on the ready lists
-	void addready(Task *t) { readyList.addLast(&t->mylink) ; }
-	void removeready(Task *t) { t->mylink.remove() ; }
+	void addready(Task *t) ;
+	void addreadyFirst(Task *t) ;
+	void removeready(Task *t) ;
 	char addNewTask(Task *t) ;
-	void removeTask() ;
+	void removeTask(Task *t) ;
+    // takes a task off whatever it is on, hands over its mutexes, wakes 
+    // its joiners and returns its slot and stack (interrupts disabled)
+	void reclaim(Task *t) ;
+    // the active task waits for t to end - FALSE if the timeout expired
+	char join(Task *t, unsigned int timeout) ;
 	char timerISR();
 
+    // called from the tick interrupt, see machine.cpp
+	void tick(unsigned int ticks) ;
+	unsigned char *tickSwitch(unsigned char *sp, unsigned int ticks) ;
+
+    // ticks since multitasking started
+	volatile unsigned long tickCount ;
+
+    // puts the processor to sleep until a task becomes ready
+	void idle() ;
+
+    // TRUE while idle() sleeps, so the tick doesn't try to preempt
+	volatile char idling ;
+
+    // TRUE while the tick runs - resched() then only picks the next task
+    // and the tick interrupt does the switch on its way out
+	char inTick ;
+
+    // round robin quantum in ticks for each priority level (0 for none)
+	unsigned char timeSlice[PRIORITY_LEVELS] ;
+    // charges the tick to the active task's slice, and moves it behind
+    // its ready peers when the slice runs out
+	void slice(unsigned int ticks) ;
+
+    // number of times idle() slept, and the CPU cycles spent asleep
+	unsigned long idleEntries ;
+	unsigned long sleptCycles ;
+
+#ifdef ARTK_STATS
+    // the idle time in the current window, counted as a task
+	TaskStats idleStats ;
+    // bumped by resetStats() to zero every task's stats lazily
+	unsigned char statsEpoch ;
+    // cycle counts at the last charge, and at the start of the window
+	unsigned long statsStamp ;
+	unsigned long windowStart ;
+
+    // a task's stats for the current window (the idle stats for NULL)
+	TaskStats *statsOf(Task *t) ;
+    // charges the cycles since the last charge to whoever had the CPU
+	void account() ;
+	void resetStats() ;
+#endif
+
     // called by the active task when it is willing to yield
 	void relinquish() ;
 
     // reschedules the processor to next highest priority task
 	void resched();
 
-    // creates the single allowed instance (private constructor below)
-	static void Instance() ;
+    // gives up the processor if a task of higher priority than the 
+    // active task is ready.  The active task stays at the front of its list.
+	void preempt() ;
+
+    // as above, from an interrupt that is not the tick
+	void preemptFromISR() ;
+
+    // wait lists for semaphores and other blocking objects
+    // insert in priority order, FIFO among equal priorities
+	void addWaiter(DNode *waitList, Task *t) ;
+    // the active task waits on waitList (called with interrupts disabled)
+	void block(DNode *waitList) ;
+    // as above, but also goes on the sleep queue if timeout isn't 0 
+    // returns FALSE if the timeout expired first, with interrupts enabled
+	char blockTimeout(DNode *waitList, unsigned int timeout) ;
+    // readies the front task of waitList, returns it (NULL if none)
+	Task *unblock(DNode *waitList) ;
+    // readies a task from anywhere in the list it waits on
+	void unblockTask(Task *t) ;
+    // readies a task the sleep queue has released
+	void wakeup(Task *t) ;
+    // TRUE if t, just readied, should take over from the active task - it
+    // has a higher priority, or under ARTK_EDF an earlier deadline at the
+    // same one
+	char outranks(Task *t) ;
+
+    // changes the base priority of a task, moving it between ready lists
+	void setPriority(Task *t, unsigned char prio) ;
+
+    // changes the effective priority of a task, moving it within whatever
+    // ready or wait list it is on.  Called with interrupts disabled.
+	void changePriority(Task *t, unsigned char prio) ;
+
+    // passes the priority of t on to the owner of the mutex it waits for,
+    // and on down the chain
+	void inherit(Task *t) ;
+
+    // works out the priority of t again from its base priority and the
+    // waiters for the mutexes it holds, and if that changed does the same
+    // on down the chain of owners - for when it may have dropped
+	void updatePriority(Task *t) ;
+
+#ifdef ARTK_EDF
+    // TRUE if a runs before b at the same priority - it has a deadline
+    // and b has none or a later one
+	static char earlier(Task *a, Task *b) ;
+    // puts t on its ready list in deadline order, ahead of the tasks it 
+    // ties with if first is TRUE
+	void insertReady(Task *t, char first) ;
+    // t is readied by something other than a preemption or a yield, which
+    // starts a new job with its deadline counted from now
+	void release(Task *t) { t->deadline = tickCount + t->relDeadline ; }
+    // the job of the active task ends as it blocks or sleeps
+	void jobDone() ;
+	void setDeadline(Task *t, unsigned int ticks) ;
+    // returns and clears the deadline miss count of t
+	unsigned int takeMisses(Task *t) ;
+#endif
 
 private:
+    // the single allowed instance, statically allocated
+    static Scheduler instance ;
     Scheduler() ;
 
 public:
@@ -33,7 +33,8 @@
 
 
 // Usage Notes:
-// ARTK makes use of the Arduino TimerOne library, which is distributed with it.
+// ARTK drives its tick from a Timer1 compare interrupt, so the TimerOne
+// library (or anything else that uses Timer1) can't be used alongside it.
 // You must NOT implement a setup() function
 // Implement a Setup() function instead - ARTK will call it for you
 // You must NOT implement a loop() function
@@ -45,112 +46,364 @@
 // SP points to next free location (post decr on push, pre incr on pop)
 // Low byte of ret addr goes on first (at the higher addr)
 //
+// Everything here is AVR code - extras/host has the host version
+#ifdef __AVR__
+
 #include  <Arduino.h> 
+#include  <avr/sleep.h>
 #include "machine.h"
 
-// perform a context switch
-// firstRun is true when the incoming task is being run for the first time
-void ContextSwitch(unsigned char **fromSP, unsigned char *toSP, int firstRun)
+// Saved frames - see machine.h for the layouts
+
+#if defined(__AVR_HAVE_RAMPZ__)
+   #define SAVE_RAMPZ     "in   r0, 0x3b      \n\t" "push r0            \n\t"
+   #define RESTORE_RAMPZ  "pop  r0            \n\t" "out  0x3b, r0      \n\t"
+#else
+   #define SAVE_RAMPZ
+   #define RESTORE_RAMPZ
+#endif
+#if defined(__AVR_HAVE_EIJMP_EICALL__)
+   #define SAVE_EIND      "in   r0, 0x3c      \n\t" "push r0            \n\t"
+   #define RESTORE_EIND   "pop  r0            \n\t" "out  0x3c, r0      \n\t"
+#else
+   #define SAVE_EIND
+   #define RESTORE_EIND
+#endif
+
+// pushes a full frame - interrupts must already be disabled
+#define SAVE_FULL_CONTEXT  \
+   "push r0            \n\t"  \
+   "in   r0, __SREG__  \n\t"  \
+   "push r0            \n\t"  \
+   SAVE_RAMPZ  \
+   SAVE_EIND  \
+   "push r1            \n\t"  \
+   "clr  r1            \n\t"  \
+   "push r2            \n\t"  \
+   "push r3            \n\t"  \
+   "push r4            \n\t"  \
+   "push r5            \n\t"  \
+   "push r6            \n\t"  \
+   "push r7            \n\t"  \
+   "push r8            \n\t"  \
+   "push r9            \n\t"  \
+   "push r10           \n\t"  \
+   "push r11           \n\t"  \
+   "push r12           \n\t"  \
+   "push r13           \n\t"  \
+   "push r14           \n\t"  \
+   "push r15           \n\t"  \
+   "push r16           \n\t"  \
+   "push r17           \n\t"  \
+   "push r18           \n\t"  \
+   "push r19           \n\t"  \
+   "push r20           \n\t"  \
+   "push r21           \n\t"  \
+   "push r22           \n\t"  \
+   "push r23           \n\t"  \
+   "push r24           \n\t"  \
+   "push r25           \n\t"  \
+   "push r26           \n\t"  \
+   "push r27           \n\t"  \
+   "push r28           \n\t"  \
+   "push r29           \n\t"  \
+   "push r30           \n\t"  \
+   "push r31           \n\t"  \
+   "ldi  r31, 1        \n\t"  \
+   "push r31           \n\t"
+
+// pushes a cooperative frame (r1 is always 0, which is FRAME_COOP)
+#define SAVE_COOP_CONTEXT  \
+   "push r2            \n\t"  \
+   "push r3            \n\t"  \
+   "push r4            \n\t"  \
+   "push r5            \n\t"  \
+   "push r6            \n\t"  \
+   "push r7            \n\t"  \
+   "push r8            \n\t"  \
+   "push r9            \n\t"  \
+   "push r10           \n\t"  \
+   "push r11           \n\t"  \
+   "push r12           \n\t"  \
+   "push r13           \n\t"  \
+   "push r14           \n\t"  \
+   "push r15           \n\t"  \
+   "push r16           \n\t"  \
+   "push r17           \n\t"  \
+   "push r28           \n\t"  \
+   "push r29           \n\t"  \
+   "push r1            \n\t"
+
+// pops whichever frame SP points at and resumes it with interrupts enabled
+// FRAME_COOP is 0 and FRAME_FULL is 1
+#define RESTORE_CONTEXT  \
+   "pop  r31           \n\t"  \
+   "cpi  r31, 1        \n\t"  \
+   "breq 2f            \n\t"  \
+   "pop  r29           \n\t"  \
+   "pop  r28           \n\t"  \
+   "pop  r17           \n\t"  \
+   "pop  r16           \n\t"  \
+   "pop  r15           \n\t"  \
+   "pop  r14           \n\t"  \
+   "pop  r13           \n\t"  \
+   "pop  r12           \n\t"  \
+   "pop  r11           \n\t"  \
+   "pop  r10           \n\t"  \
+   "pop  r9            \n\t"  \
+   "pop  r8            \n\t"  \
+   "pop  r7            \n\t"  \
+   "pop  r6            \n\t"  \
+   "pop  r5            \n\t"  \
+   "pop  r4            \n\t"  \
+   "pop  r3            \n\t"  \
+   "pop  r2            \n\t"  \
+   "reti               \n\t"  \
+   "2:                 \n\t"  \
+   "pop  r31           \n\t"  \
+   "pop  r30           \n\t"  \
+   "pop  r29           \n\t"  \
+   "pop  r28           \n\t"  \
+   "pop  r27           \n\t"  \
+   "pop  r26           \n\t"  \
+   "pop  r25           \n\t"  \
+   "pop  r24           \n\t"  \
+   "pop  r23           \n\t"  \
+   "pop  r22           \n\t"  \
+   "pop  r21           \n\t"  \
+   "pop  r20           \n\t"  \
+   "pop  r19           \n\t"  \
+   "pop  r18           \n\t"  \
+   "pop  r17           \n\t"  \
+   "pop  r16           \n\t"  \
+   "pop  r15           \n\t"  \
+   "pop  r14           \n\t"  \
+   "pop  r13           \n\t"  \
+   "pop  r12           \n\t"  \
+   "pop  r11           \n\t"  \
+   "pop  r10           \n\t"  \
+   "pop  r9            \n\t"  \
+   "pop  r8            \n\t"  \
+   "pop  r7            \n\t"  \
+   "pop  r6            \n\t"  \
+   "pop  r5            \n\t"  \
+   "pop  r4            \n\t"  \
+   "pop  r3            \n\t"  \
+   "pop  r2            \n\t"  \
+   "pop  r1            \n\t"  \
+   RESTORE_EIND  \
+   RESTORE_RAMPZ  \
+   "pop  r0            \n\t"  \
+   "out  __SREG__, r0  \n\t"  \
+   "pop  r0            \n\t"  \
+   "reti               \n\t"
+
+// perform a cooperative context switch
+// called by the kernel, with interrupts disabled, on behalf of a task that
+// sleeps, yields or blocks.  fromSP is in r25:r24, toSP in r23:r22.
+// The incoming task may have been saved by either path.
+void ContextSwitch(unsigned char **fromSP, unsigned char *toSP)
 {
-   // push registers to exiting process stack
-   asm volatile (
-     "push r0            \n\t"
-     "in   r0, __SREG__  \n\t"
-     "cli                \n\t"
-     "push r0            \n\t"
-     "push r1            \n\t"
-     "clr  r1            \n\t"
-     "push r2            \n\t"
-     "push r3            \n\t"
-     "push r4            \n\t"
-     "push r5            \n\t"
-     "push r6            \n\t"
-     "push r7            \n\t"
-     "push r8            \n\t"
-     "push r9            \n\t"
-     "push r10           \n\t"
-     "push r11           \n\t"
-     "push r12           \n\t"
-     "push r13           \n\t"
-     "push r14           \n\t"
-     "push r15           \n\t"
-     "push r16           \n\t"
-     "push r17           \n\t"
-     "push r18           \n\t"
-     "push r19           \n\t"
-     "push r20           \n\t"
-     "push r21           \n\t"
-     "push r22           \n\t"
-     "push r23           \n\t"
-     "push r24           \n\t"
-     "push r25           \n\t"
-     "push r26           \n\t"
-     "push r27           \n\t"
-     "push r28           \n\t"
-     "push r29           \n\t"
-     "push r30           \n\t"
-     "push r31           \n\t"
-   ) ;
-     
-   // update the exiting process SP
-   *fromSP = (unsigned char *)(SP) ;
-      
-   // pop registers from starting process stack
-   SP = (unsigned int)toSP ;
-   if (firstRun)
    asm volatile (
-     "sei                \n\t"
-     "ret                \n\t"
-   ) ;
-   else
-   asm volatile (
-     "pop  r31           \n\t"
-     "pop  r30           \n\t"
-     "pop  r29           \n\t"
-     "pop  r28           \n\t"
-     "pop  r27           \n\t"
-     "pop  r26           \n\t"
-     "pop  r25           \n\t"
-     "pop  r24           \n\t"
-     "pop  r23           \n\t"
-     "pop  r22           \n\t"
-     "pop  r21           \n\t"
-     "pop  r20           \n\t"
-     "pop  r10           \n\t"
-     "pop  r18           \n\t"
-     "pop  r17           \n\t"
-     "pop  r16           \n\t"
-     "pop  r15           \n\t"
-     "pop  r14           \n\t"
-     "pop  r13           \n\t"
-     "pop  r12           \n\t"
-     "pop  r11           \n\t"
-     "pop  r10           \n\t"
-     "pop  r9            \n\t"
-     "pop  r8            \n\t"
-     "pop  r7            \n\t"
-     "pop  r6            \n\t"
-     "pop  r5            \n\t"
-     "pop  r4            \n\t"
-     "pop  r3            \n\t"
-     "pop  r2            \n\t"
-     "pop  r1            \n\t"
-     "clr  r1            \n\n"
-     "pop  r0            \n\t"
-     "out  __SREG__, r0  \n\t"
-     "pop  r0            \n\t"
-     "sei                \n\t"
+     SAVE_COOP_CONTEXT
+     "movw r30, r24      \n\t"
+     "in   r0, __SP_L__  \n\t"
+     "st   Z+, r0        \n\t"
+     "in   r0, __SP_H__  \n\t"
+     "st   Z, r0         \n\t"
+     "out  __SP_H__, r23 \n\t"
+     "out  __SP_L__, r22 \n\t"
+     RESTORE_CONTEXT
    ) ;
 }
 
-// perform a context switch to the very first task (Main task)
+// perform a context switch to the very first task
 // a bit of a hack in that the context of main() is simply left stranded
+// toSP is in r25:r24
 void FirstSwitch(unsigned char *toSP)
 {
-   // pop registers from starting process stack
-   SP = (unsigned int)toSP ;
    asm volatile (
-     "sei                \n\t"
-     "ret                \n\t"
+     "out  __SP_H__, r25 \n\t"
+     "out  __SP_L__, r24 \n\t"
+     RESTORE_CONTEXT
+   ) ;
+}
+
+unsigned char *StackPointer()
+{
+   return (unsigned char *)SP ;
+}
+
+// pushes a code address the way a call instruction would
+static unsigned char *pushAddress(unsigned char *sp, void (*fn)(), 
+                                  char largeModel)
+{
+   *sp-- = (unsigned char)((long)fn & 0x00ff) ;
+   *sp-- = (unsigned char)(((long)fn >> 8) & 0x00ff) ;
+   if (largeModel)
+      *sp-- = (unsigned char)(((long)fn >> 16) & 0x00ff) ;
+   return sp ;
+}
+
+unsigned char *InitialFrame(unsigned char *base, unsigned int size,
+                            void (*root)(), void (*done)(), char largeModel)
+{
+   unsigned char *sp = &base[size-1] ;
+   unsigned char i ;
+
+   // the root function returns into done
+   sp = pushAddress(sp, done, largeModel) ;
+   // next put the entry function on the stack so we return to it after
+   // returning from a context switch
+   sp = pushAddress(sp, root, largeModel) ;
+   for (i = 0; i < COOP_FRAME_REGS; i++)
+      *sp-- = 0 ;
+   *sp-- = FRAME_COOP ;
+   return sp ;
+}
+
+// Kernel tick
+// Timer1 runs in CTC mode at clk/64 (4us per count at 16 MHz), so a tick
+// can be up to about 262 ms, and so can a stretched tick while idle.
+#define TICK_PRESCALE        64
+#define TICK_COUNTS_PER_MS   (F_CPU / TICK_PRESCALE / 1000)
+
+// timer counts per tick
+static unsigned int tickCounts = TICK_COUNTS_PER_MS ;
+// ticks covered by the current compare period
+static volatile unsigned int tickStretch = 1 ;
+
+// Called from the tick interrupt once the interrupted task's full frame
+// is on its stack.  Returns the stack pointer of the task to resume.
+extern "C" unsigned char *TickPreempt(unsigned char *sp) __attribute__((used)) ;
+unsigned char *TickPreempt(unsigned char *sp)
+{
+   unsigned int ticks = tickStretch ;
+
+   if (ticks != 1)
+   {
+      // TCNT1 has just been cleared, so this takes effect for the next tick
+      OCR1A = tickCounts - 1 ;
+      tickStretch = 1 ;
+   }
+   return KernelTick(sp, ticks) ;
+}
+
+// The tick saves a full frame, as it can preempt a task anywhere
+ISR(TIMER1_COMPA_vect, ISR_NAKED)
+{
+   asm volatile (
+     SAVE_FULL_CONTEXT
+     "in   r24, __SP_L__ \n\t"
+     "in   r25, __SP_H__ \n\t"
+     "call TickPreempt   \n\t"
+     "out  __SP_H__, r25 \n\t"
+     "out  __SP_L__, r24 \n\t"
+     RESTORE_CONTEXT
    ) ;
 }
+
+void TickStart(unsigned long usec)
+{
+   unsigned long counts = usec * TICK_COUNTS_PER_MS / 1000 ;
+
+   if (counts == 0)
+      counts = 1 ;
+   else if (counts > 0xFFFFUL)
+      counts = 0xFFFFUL ;
+
+   tickCounts = (unsigned int)counts ;
+   tickStretch = 1 ;
+   TCCR1B = 0 ;
+   TCCR1A = 0 ;
+   TCNT1 = 0 ;
+   OCR1A = tickCounts - 1 ;
+   TIFR1 = _BV(OCF1A) ;
+   TIMSK1 |= _BV(OCIE1A) ;
+   TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10) ;
+}
+
+void TickStretch(unsigned long ticks)
+{
+   unsigned long most = 0x10000UL / tickCounts ;
+
+   // already stretched, or a tick is pending and will be taken first
+   if (tickStretch != 1 || (TIFR1 & _BV(OCF1A)))
+      return ;
+   if (ticks == 0 || ticks > most)
+      ticks = most ;
+   if (ticks < 2)
+      return ;
+   tickStretch = (unsigned int)ticks ;
+   OCR1A = (unsigned int)(ticks * tickCounts - 1) ;
+}
+
+unsigned int TickResume()
+{
+   unsigned int count ;
+   unsigned int ticks ;
+
+   if (tickStretch == 1)
+      return 0 ;
+   // The count is read before the flag is checked, so a compare that 
+   // comes between the two shows in the flag rather than as a count that
+   // has just cleared.  If the stretched tick is pending its interrupt 
+   // will report it.
+   count = TCNT1 ;
+   if (TIFR1 & _BV(OCF1A))
+      return 0 ;
+   ticks = count / tickCounts ;
+   TCNT1 = count - ticks * tickCounts ;
+   OCR1A = tickCounts - 1 ;
+   tickStretch = 1 ;
+   // The compare can still come just after the check, with the count in
+   // the stretch's last tick.  Its interrupt now reports that tick as 1
+   // on top of those returned, and the next one starts from there.
+   if (TIFR1 & _BV(OCF1A))
+      TCNT1 = 0 ;
+   return ticks ;
+}
+
+unsigned int TickPhase()
+{
+   return TCNT1 ;
+}
+
+unsigned long TickCycles(unsigned long ticks, unsigned int phase)
+{
+   return (ticks * tickCounts + phase) * TICK_PRESCALE ;
+}
+
+unsigned int TickStamp(unsigned long *ticks)
+{
+   unsigned int phase = TCNT1 ;
+
+   // the counter may have cleared after it was read, so read it again
+   if (TIFR1 & _BV(OCF1A))
+   {
+      *ticks += tickStretch ;
+      phase = TCNT1 ;
+   }
+   return phase ;
+}
+
+unsigned long CycleCount(unsigned long ticks)
+{
+   unsigned int phase = TickStamp(&ticks) ;
+
+   return TickCycles(ticks, phase) ;
+}
+
+void IdleSleep(char deep)
+{
+   set_sleep_mode(deep ? SLEEP_MODE_PWR_DOWN : SLEEP_MODE_IDLE) ;
+   sleep_enable() ;
+   // the instruction following sei is always executed before an interrupt,
+   // so a wakeup can't slip in between the caller's check and the sleep
+   sei() ;
+   sleep_cpu() ;
+   sleep_disable() ;
+   cli() ;
+}
+
+#endif // __AVR__
@@ -33,7 +33,8 @@
 
 
 // Usage Notes:
-// ARTK makes use of the Arduino TimerOne library, which is distributed with it.
+// ARTK drives its tick from a Timer1 compare interrupt, so the TimerOne
+// library (or anything else that uses Timer1) can't be used alongside it.
 // You must NOT implement a setup() function
 // Implement a Setup() function instead - ARTK will call it for you
 // You must NOT implement a loop() function
@@ -46,9 +47,90 @@
 // these are machine dependent functions that use inline assembly - 
 // see machine.cpp
 
-void ContextSwitch(unsigned char **fromSP, unsigned char *toSP, int firstRun) ;
-//     __attribute__((naked)) ;
-void FirstSwitch(unsigned char *toSP) ;
-//     __attribute__((naked)) ;
+// Saved frames, from the highest address down.  A task's saved SP points 
+// just below the marker byte, which tells the restore which layout it is.
+//
+// Cooperative frame (19 bytes plus return address), saved by ContextSwitch
+// when a task calls into the kernel.  The AVR ABI only requires the 
+// call-saved registers to survive a call:
+//    return address (low byte first, 3 bytes on large model parts)
+//    r2, r3, ... r17, r28, r29
+//    FRAME_COOP
+//
+// Full frame (37 bytes plus return address), saved by the tick interrupt,
+// which can preempt a task anywhere:
+//    return address
+//    r0, SREG, [RAMPZ], [EIND], r1, r2, ... r31
+//    FRAME_FULL
+//
+// A new task starts with a cooperative frame built by InitialFrame, with
+// the root function as the return address and Task::taskDone below it,
+// so its first run is an ordinary resume.
+//
+// Off the AVR (see extras/host) the same interface is implemented with
+// ucontext, and a "stack pointer" is the address of the task's saved
+// context, kept at the top of its stack.
+#define FRAME_COOP        0
+#define FRAME_FULL        1
+#define COOP_FRAME_REGS   18
+// bytes a cooperative switch puts below the caller's SP, at most
+#define COOP_FRAME_SIZE   (COOP_FRAME_REGS + 1 + 3)
+
+// Both are naked - the frames above are all they put on the stack, 
+// whatever the optimization level - and never inlined, which with LTO 
+// would lose the call they rely on for the return address.  They must be
+// called with interrupts disabled and resume the incoming task with 
+// interrupts enabled.
+#ifdef __AVR__
+	#define MACHINE_NAKED __attribute__((naked, noinline))
+#else
+	#define MACHINE_NAKED
+#endif
+void ContextSwitch(unsigned char **fromSP, unsigned char *toSP) 
+     MACHINE_NAKED ;
+void FirstSwitch(unsigned char *toSP) 
+     MACHINE_NAKED ;
+
+// builds the frame a new task is first resumed from, in the stack of size
+// bytes at base, and returns its stack pointer.  largeModel selects 3 byte
+// code addresses.
+unsigned char *InitialFrame(unsigned char *base, unsigned int size,
+                            void (*root)(), void (*done)(), char largeModel) ;
+
+// current stack pointer
+unsigned char *StackPointer() ;
+
+// Kernel tick - Timer1 in CTC mode interrupts every tick and calls 
+// KernelTick() (in kernel.cpp) with the number of ticks elapsed and the
+// stack pointer of the interrupted task, whose full frame has been saved.
+// KernelTick returns the stack pointer of the task to resume.
+// TickStart sets the tick period in microseconds and starts the timer.
+void TickStart(unsigned long usec) ;
+unsigned char *KernelTick(unsigned char *sp, unsigned int ticks) ;
+
+// Tickless idle support, for use with interrupts disabled.
+// TickStretch makes the next tick interrupt arrive that many ticks after
+// the last one (0 for as long as the timer allows) and report them all at
+// once.  TickResume cancels a stretch early, returning the whole ticks that
+// have already elapsed, which the caller must credit.
+void TickStretch(unsigned long ticks) ;
+unsigned int TickResume() ;
+
+// timer counts into the current tick, and the conversion of a number of
+// ticks plus timer counts into CPU cycles
+unsigned int TickPhase() ;
+unsigned long TickCycles(unsigned long ticks, unsigned int phase) ;
+
+// Time stamps, for use with interrupts disabled.  A tick may have come due
+// without its interrupt having been taken yet, in which case the timer has
+// already started on the next one.  TickStamp advances *ticks (the kernel's
+// tick count) past such a tick and returns the timer counts since it, and
+// CycleCount gives the same instant in CPU cycles.
+unsigned int TickStamp(unsigned long *ticks) ;
+unsigned long CycleCount(unsigned long ticks) ;
+
+// Must be called with interrupts disabled and returns with them disabled.
+// Sleeps until the next interrupt; deep selects power-down instead of idle.
+void IdleSleep(char deep) ;
 
 #endif